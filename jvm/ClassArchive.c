@@ -0,0 +1,373 @@
+/* ClassArchive.c */
+
+/*
+   Implements a shared class archive.
+
+   A run with the -Xshare:dump option saves the ClassFile structures of
+   all the classes that it loaded in an archive file.  Later runs map
+   the archive into memory read-only and use those structures directly,
+   instead of reading, parsing and verifying the class files again.
+   Because the mapping is read-only and backed by the file, all the JVM
+   processes on one host which use the archive share its physical pages.
+
+   * OpenClassArchive   -- maps an archive into memory
+   * FindArchivedClass  -- returns the archived copy of a class, if any
+   * IsArchivedClass    -- reports whether the archive holds a class
+   * DumpClassArchive   -- writes the loaded classes to an archive
+
+   The archive holds one contiguous image of the structures, in which
+   every pointer holds the address that its target would have if the
+   image were mapped at ARCHIVEBASE.  The image is normally mapped at
+   that address and needs no changes.  If the address range is taken,
+   the image is mapped elsewhere as a private copy, and each pointer is
+   adjusted; a bitmap in the archive, with one bit for each 8-byte word
+   of the image, identifies the words which hold pointers.
+
+   The archived classes do not keep their class file images: every
+   method body is completed (see MaterializeMethod) and copied into the
+   archive as it is written.  UTF8 constants are interned as the archive
+   is written, so a name used by many classes is stored only once.
+   Each archived class records the size and modification time of the
+   file it came from (the class file, or the jar holding it); if that
+   file has changed, the archived copy is ignored and the class file is
+   read instead.
+
+   Layout of the archive file:
+       ArchiveHeader
+       image:  ArchivedClass index, ClassFile structures and their data
+       relocation bitmap
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "ClassFileFormat.h"
+#include "ReadClassFile.h"
+#include "ClassPath.h"
+#include "ClassResolver.h"
+#include "NameTable.h"
+#include "TraceOptions.h"
+#include "MyAlloc.h"
+#include "Verifier.h"
+#include "ClassArchive.h"
+
+#define ARCHIVEMAGIC   "MyJVMcds"
+#define ARCHIVEVERSION 2
+
+/* the address at which the image is normally mapped */
+#define ARCHIVEBASE ((uintptr_t)0x600000000000)
+
+typedef struct {
+    char     magic[8];
+    uint32_t version;
+    uint32_t numClasses;
+    uint64_t base;          /* address assumed by pointers in the image */
+    uint64_t imageSize;     /* bytes in the image, a multiple of the page size */
+    uint64_t bitmapSize;    /* bytes in the relocation bitmap */
+} ArchiveHeader;
+
+typedef struct {
+    char      *name;        /* the class name */
+    ClassFile *cf;
+    int64_t    fileSize;    /* status of the file it was read from */
+    int64_t    mtimeSec;
+    int64_t    mtimeNsec;
+} ArchivedClass;
+
+static uint8_t *image = NULL;       /* the mapped image */
+static NameTable archivedClasses;   /* class name -> ArchivedClass */
+
+/* the image and bitmap being built by DumpClassArchive */
+static uint8_t *out = NULL;
+static size_t outSize = 0, outCapacity = 0;
+static uint8_t *outBitmap = NULL;
+static NameTable internedNames;     /* UTF8 constant -> its offset + 1 */
+
+
+/* Maps the archive at path, if possible.  The result is 1 if the archive
+   can be used; if not, a message is printed when required is nonzero. */
+int OpenClassArchive( char *path, int required ) {
+    ArchiveHeader hdr;
+    ArchivedClass *ac;
+    uint8_t *bitmap, *p;
+    uint64_t i;
+    intptr_t delta;
+    int fd;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        if (required)
+            fprintf(stderr, "Unable to open shared class archive %s\n", path);
+        return 0;
+    }
+    if (read(fd, &hdr, sizeof(hdr)) != sizeof(hdr)
+            || memcmp(hdr.magic, ARCHIVEMAGIC, 8) != 0
+            || hdr.version != ARCHIVEVERSION) {
+        if (required)
+            fprintf(stderr, "File %s is not a usable shared class archive\n", path);
+        close(fd);
+        return 0;
+    }
+    p = mmap((void*)(uintptr_t)hdr.base, hdr.imageSize, PROT_READ,
+        MAP_PRIVATE|MAP_FIXED_NOREPLACE, fd, sysconf(_SC_PAGESIZE));
+    if (p != MAP_FAILED && p != (uint8_t*)(uintptr_t)hdr.base) {
+        munmap(p, hdr.imageSize);  // an old kernel treated the address as a hint
+        p = MAP_FAILED;
+    }
+    if (p == MAP_FAILED) {
+        /* the image must be relocated in a private copy */
+        p = mmap(NULL, hdr.imageSize, PROT_READ|PROT_WRITE, MAP_PRIVATE,
+            fd, sysconf(_SC_PAGESIZE));
+        if (p == MAP_FAILED) {
+            if (required)
+                fprintf(stderr, "Unable to map shared class archive %s\n", path);
+            close(fd);
+            return 0;
+        }
+        bitmap = SafeMalloc(hdr.bitmapSize);
+        if (pread(fd, bitmap, hdr.bitmapSize, sysconf(_SC_PAGESIZE)+hdr.imageSize)
+                != hdr.bitmapSize) {
+            if (required)
+                fprintf(stderr, "Shared class archive %s is truncated\n", path);
+            munmap(p, hdr.imageSize);
+            SafeFree(bitmap);
+            close(fd);
+            return 0;
+        }
+        delta = (intptr_t)p - (intptr_t)hdr.base;
+        for( i = 0;  i < hdr.bitmapSize*8;  i++ ) {
+            if (bitmap[i>>3] & (1 << (i&7)))
+                *(uintptr_t*)(p + i*8) += delta;
+        }
+        SafeFree(bitmap);
+        mprotect(p, hdr.imageSize, PROT_READ);
+        if (tracingExecution & TRACE_CLASS_LOADS)
+            printf("shared class archive %s relocated by %ld bytes\n",
+                path, (long)delta);
+    }
+    close(fd);
+    image = p;
+    ac = (ArchivedClass*)image;
+    for( i = 0;  i < hdr.numClasses;  i++, ac++ )
+        NameTableInsert(&archivedClasses, ac->name)->value = ac;
+    return 1;
+}
+
+
+/* Returns 1 if the archive holds a copy of the named class */
+int IsArchivedClass( char *classname ) {
+    return NameTableLookup(&archivedClasses, classname) != NULL;
+}
+
+
+/* Returns the archived ClassFile structure for the named class, or NULL
+   if there is none or if the class file has changed since the archive
+   was written.  The structure is read-only. */
+ClassFile *FindArchivedClass( char *classname ) {
+    NameEntry *ne;
+    ArchivedClass *ac;
+    struct stat sb;
+
+    ne = NameTableLookup(&archivedClasses, classname);
+    if (ne == NULL)
+        return NULL;
+    ac = ne->value;
+    if (!StatClassFile(classname, &sb) || sb.st_size != ac->fileSize
+            || sb.st_mtim.tv_sec != ac->mtimeSec
+            || sb.st_mtim.tv_nsec != ac->mtimeNsec) {
+        if (showWarnings)
+            fprintf(stderr, "Warning: class %s has changed since the shared "
+                "class archive was written\n", classname);
+        return NULL;
+    }
+    if (tracingExecution & TRACE_CLASS_LOADS)
+        printf("found %s.class in shared class archive\n", classname);
+    return ac->cf;
+}
+
+
+/* Appends size bytes, copied from data if it is not NULL, to the image
+   being built.  Every item starts on an 8-byte boundary.  The result is
+   the offset of the item in the image. */
+static size_t emit( void *data, size_t size ) {
+    size_t offset = outSize;
+    size_t newSize = (outSize + size + 7) & ~(size_t)7;
+
+    if (newSize > outCapacity) {
+        size_t newCapacity = (outCapacity == 0)? 65536 : outCapacity;
+        while(newCapacity < newSize)
+            newCapacity *= 2;
+        out = realloc(out, newCapacity);
+        outBitmap = realloc(outBitmap, newCapacity/64);
+        if (out == NULL || outBitmap == NULL) {
+            fprintf(stderr, "Fatal error: memory request cannot be satisfied\n");
+            exit(1);
+        }
+        memset(out+outCapacity, 0, newCapacity-outCapacity);
+        memset(outBitmap+outCapacity/64, 0, (newCapacity-outCapacity)/64);
+        outCapacity = newCapacity;
+    }
+    if (data != NULL)
+        memcpy(out+offset, data, size);
+    outSize = newSize;
+    return offset;
+}
+
+
+/* Makes the pointer at offset at in the image refer to offset target */
+static void setPointer( size_t at, size_t target ) {
+    *(uintptr_t*)(out+at) = ARCHIVEBASE + target;
+    outBitmap[at/64] |= 1 << ((at/8)&7);
+}
+
+
+/* Copies a block of size bytes into the image, unless p is NULL, and sets
+   the pointer at offset at to refer to the copy */
+static void emitBlock( size_t at, void *p, size_t size ) {
+    if (p == NULL)
+        return;
+    setPointer(at, emit(p, size));
+}
+
+
+/* As for emitBlock, but for a UTF8 constant, which is stored only once */
+static void emitUTF8( size_t at, uint8_t *s ) {
+    NameEntry *ne;
+    int len;
+
+    if (s == NULL)
+        return;
+    ne = NameTableInsert(&internedNames, (char *)(s+2));
+    if (ne->value == NULL) {
+        len = (s[0] << 8) + s[1];
+        ne->value = (void*)(emit(s, len+3) + 1);
+    }
+    setPointer(at, (size_t)ne->value - 1);
+}
+
+
+static void emitClass( size_t at, ClassFile *cf ) {
+    ClassFile copy = *cf;
+    size_t cfOff, itemOff, mOff;
+    int i;
+
+    /* method bodies are stored complete, and verified if the verifier
+       is on; otherwise they are verified when first used, as usual */
+    Verify(cf);
+    copy.verified = VerifyingMethods != 0;
+    copy.image = NULL;
+    copy.image_size = 0;
+    copy.image_mapped = 0;
+    copy.arena = NULL;
+    cfOff = emit(&copy, sizeof(ClassFile));
+    setPointer(at, cfOff);
+    emitBlock(cfOff+offsetof(ClassFile,cname), cf->cname, strlen(cf->cname)+1);
+    emitBlock(cfOff+offsetof(ClassFile,cp_tag), cf->cp_tag,
+        cf->constant_pool_count);
+    itemOff = emit(cf->cp_item, cf->constant_pool_count*sizeof(ConstantPoolItem));
+    setPointer(cfOff+offsetof(ClassFile,cp_item), itemOff);
+    for( i = 1;  i < cf->constant_pool_count;  i++ ) {
+        if (cf->cp_tag[i] == CP_UTF8)
+            emitUTF8(itemOff+i*sizeof(ConstantPoolItem), cf->cp_item[i].sval);
+    }
+    emitBlock(cfOff+offsetof(ClassFile,interfaces), cf->interfaces,
+        cf->interfaces_count*sizeof(u2));
+    emitBlock(cfOff+offsetof(ClassFile,fields), cf->fields,
+        cf->fields_count*sizeof(field_info));
+    mOff = emit(cf->methods, cf->methods_count*sizeof(method_info));
+    setPointer(cfOff+offsetof(ClassFile,methods), mOff);
+    for( i = 0;  i < cf->methods_count;  i++ ) {
+        method_info *m = &cf->methods[i];
+        size_t at = mOff + i*sizeof(method_info);
+        emitBlock(at+offsetof(method_info,code), m->code, m->code_length);
+        emitBlock(at+offsetof(method_info,exception_table), m->exception_table,
+            m->exception_table_length);
+        emitBlock(at+offsetof(method_info,attributes), m->attributes,
+            m->attributes_count);
+    }
+}
+
+
+/* Writes the classes loaded so far to a new archive at path.  Each is
+   recorded under the name that it was loaded by, which is the name it
+   will be looked up by, and which may be a path to the class file
+   rather than the class's own name. */
+void DumpClassArchive( char *path ) {
+    ArchiveHeader hdr;
+    ClassType *ct;
+    ArchivedClass ac;
+    struct stat sb;
+    size_t pageSize = sysconf(_SC_PAGESIZE);
+    size_t indexOff, at;
+    char *tempPath;
+    FILE *f;
+    int n = 0;
+
+    for( ct = FirstLoadedClass;  ct != NULL;  ct = ct->nextClass ) {
+        if (!ct->isArrayType && ct->cf != NULL
+                && StatClassFile(ct->typeDescriptor, &sb))
+            n++;
+    }
+    if (n == 0) {
+        fprintf(stderr, "No class files were loaded from the class path, "
+            "so shared class archive %s was not written\n", path);
+        exit(1);
+    }
+    /* the index comes first, so that it is at the start of the image */
+    indexOff = emit(NULL, n*sizeof(ArchivedClass));
+    at = indexOff;
+    for( ct = FirstLoadedClass;  ct != NULL;  ct = ct->nextClass ) {
+        if (ct->isArrayType || ct->cf == NULL
+                || !StatClassFile(ct->typeDescriptor, &sb))
+            continue;
+        memset(&ac, 0, sizeof(ac));
+        ac.fileSize = sb.st_size;
+        ac.mtimeSec = sb.st_mtim.tv_sec;
+        ac.mtimeNsec = sb.st_mtim.tv_nsec;
+        memcpy(out+at, &ac, sizeof(ac));
+        emitBlock(at+offsetof(ArchivedClass,name), ct->typeDescriptor,
+            strlen(ct->typeDescriptor)+1);
+        emitClass(at+offsetof(ArchivedClass,cf), ct->cf);
+        at += sizeof(ArchivedClass);
+    }
+    emit(NULL, (pageSize - outSize%pageSize) % pageSize);
+
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, ARCHIVEMAGIC, 8);
+    hdr.version = ARCHIVEVERSION;
+    hdr.numClasses = n;
+    hdr.base = ARCHIVEBASE;
+    hdr.imageSize = outSize;
+    hdr.bitmapSize = outSize/64;
+
+    /* write to a new file then rename it, so that a process which is
+       mapping the old archive is not disturbed */
+    tempPath = SafeMalloc(strlen(path)+8);
+    sprintf(tempPath, "%s.XXXXXX", path);
+    f = fdopen(mkstemp(tempPath), "wb");
+    if (f == NULL) {
+        fprintf(stderr, "Unable to create shared class archive %s\n", path);
+        exit(1);
+    }
+    /* the image starts on a page boundary, so that it can be mapped */
+    fwrite(&hdr, sizeof(hdr), 1, f);
+    fseek(f, pageSize, SEEK_SET);
+    fwrite(out, 1, outSize, f);
+    fwrite(outBitmap, 1, hdr.bitmapSize, f);
+    fchmod(fileno(f), 0644);
+    if (fclose(f) != 0 || rename(tempPath, path) != 0) {
+        fprintf(stderr, "Unable to write shared class archive %s\n", path);
+        unlink(tempPath);
+        exit(1);
+    }
+    SafeFree(tempPath);
+    printf("%d classes (%lu bytes) written to shared class archive %s\n",
+        n, (unsigned long)outSize, path);
+}
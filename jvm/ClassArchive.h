@@ -0,0 +1,14 @@
+/* ClassArchive.h */
+
+#ifndef CLASSARCHIVEH
+
+#define CLASSARCHIVEH
+
+#include "ClassFileFormat.h"  /* to define ClassFile type */
+
+extern int OpenClassArchive( char *path, int required );
+extern int IsArchivedClass( char *classname );
+extern ClassFile *FindArchivedClass( char *classname );
+extern void DumpClassArchive( char *path );
+
+#endif
@@ -33,7 +33,7 @@ char *GetUTF8( ClassFile *cf, int ix ) {
 char *GetCPItemAsString( ClassFile *cf, int ix ) {
     uint8_t *r;
     char temp[32], *s1, *s2, *s3;
-    static int depth=0;
+    static __thread int depth=0;  /* per thread, as class files may be read in parallel */
     union { double d; int64_t ll; uint32_t uval[2]; } pair;
 
     if (ix <= 0 || ix > cf->constant_pool_count)
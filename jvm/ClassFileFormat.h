@@ -82,6 +82,7 @@ typedef struct {
     u2  attributes_count;
     u1  *attributes;
     u4   nArgs;  /* # arguments (including 'this' for an instance method) */
+    u1  *body;   /* Code attribute not yet parsed, see MaterializeMethod */
 } method_info;
 
 typedef struct {
@@ -98,6 +99,11 @@ typedef struct {
     field_info  *fields;
     u2     methods_count;
     method_info *methods;
+    u1     verified;      /* nonzero if Verify has already accepted it */
+    u1    *image;         /* the class file contents */
+    u4     image_size;
+    u1     image_mapped;  /* nonzero if image is mapped from the file */
+    struct Arena *arena;  /* holds all of the above, see FreeClassFile */
 } ClassFile;
 
 /* access functions */
@@ -0,0 +1,398 @@
+/* ClassPath.c */
+
+/*
+   Locates class files on the class path.
+
+   The class path is a list of entries separated by ':' characters, as
+   given by the -cp option.  An entry is either a directory or a jar/zip
+   archive.  If no class path is set, the current directory is searched.
+
+   * SetClassPath   -- replaces the class path
+   * OpenClassFile  -- searches the class path entries in order and opens
+                       the class file for the named class
+   * ProbeClassFile -- like OpenClassFile, but for speculative lookups by
+                       the prefetch threads (ClassPrefetch.c); a failed
+                       search is not remembered
+   * StatClassFile  -- gets the file status of the file that a class
+                       would be read from
+   * IsMissingClass -- reports whether an earlier search for a class
+                       found nothing
+
+   The listing of each directory is read once, when a class from that
+   package is first requested, and later requests are answered from the
+   cached listing.  The central directory of each archive is similarly
+   read once.  Names that could not be found anywhere are remembered, so
+   repeated requests for them fail immediately.
+
+   Archive members may be stored or compressed with deflate; the latter
+   are expanded with zlib.
+
+   The class path may be searched by several threads at once, so all
+   the cached information is guarded by a single lock.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <pthread.h>
+#include <zlib.h>
+
+#include "TraceOptions.h"
+#include "MyAlloc.h"
+#include "NameTable.h"
+#include "ClassPath.h"
+
+/* signatures of the zip records that we use */
+#define ZIP_LOCAL_HEADER   0x04034b50
+#define ZIP_CENTRAL_HEADER 0x02014b50
+#define ZIP_END_RECORD     0x06054b50
+
+/* compression methods for an archive member */
+#define ZIP_STORED   0
+#define ZIP_DEFLATED 8
+
+typedef struct {
+    uint32_t localHeaderOffset;
+    uint32_t compressedSize;
+    uint32_t size;
+    uint16_t method;
+} ArchiveMember;
+
+typedef struct ClassPathEntry {
+    char *path;
+    int isArchive;
+    /* for a directory: package name -> NameTable of its class file names */
+    NameTable packages;
+    /* for an archive: the mapped file and its members by name */
+    int opened;
+    uint8_t *data;
+    size_t size;
+    NameTable members;
+    struct ClassPathEntry *next;
+} ClassPathEntry;
+
+static ClassPathEntry *classPath = NULL;
+static NameTable missingClasses;  /* names that no entry could supply */
+static pthread_mutex_t classPathLock = PTHREAD_MUTEX_INITIALIZER;
+
+
+static uint16_t getU2( uint8_t *p ) {
+    return p[0] | (p[1] << 8);
+}
+
+static uint32_t getU4( uint8_t *p ) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+
+/* Replace the class path by the entries listed in path */
+void SetClassPath( char *path ) {
+    ClassPathEntry **tailp = &classPath;
+    char *s = SafeStrdup(path);
+    char *p;
+
+    pthread_mutex_lock(&classPathLock);
+    classPath = NULL;
+    for( p = strtok(s, ":");  p != NULL;  p = strtok(NULL, ":") ) {
+        struct stat sb;
+        ClassPathEntry *cpe = SafeMalloc(sizeof(ClassPathEntry));
+        cpe->path = SafeStrdup(p);
+        cpe->isArchive = stat(p, &sb) == 0 && S_ISREG(sb.st_mode);
+        *tailp = cpe;
+        tailp = &cpe->next;
+    }
+    pthread_mutex_unlock(&classPathLock);
+    SafeFree(s);
+}
+
+
+/* Forms the path name for item within directory dir */
+static char *joinPath( char *dir, char *item ) {
+    char *result;
+    if (*item == '\0')
+        return SafeStrdup(dir);
+    if (strcmp(dir, ".") == 0)
+        return SafeStrdup(item);
+    result = SafeMalloc(strlen(dir) + strlen(item) + 2);
+    sprintf(result, "%s/%s", dir, item);
+    return result;
+}
+
+
+/* Reads the names of the class files in one directory */
+static NameTable *listDirectory( char *dirname ) {
+    NameTable *listing = SafeMalloc(sizeof(NameTable));
+    DIR *d = opendir(dirname);
+    struct dirent *de;
+    int len;
+
+    if (d == NULL)
+        return listing;  /* an empty listing */
+    while((de = readdir(d)) != NULL) {
+        len = strlen(de->d_name);
+        if (len > 6 && strcmp(de->d_name+len-6, ".class") == 0)
+            NameTableInsert(listing, de->d_name);
+    }
+    closedir(d);
+    return listing;
+}
+
+
+/* Checks the cached listing of the package directory for the file */
+static int inDirectory( ClassPathEntry *cpe, char *filename ) {
+    char *slash = strrchr(filename, '/');
+    char *pkg, *dirname;
+    NameEntry *pe;
+
+    pkg = SafeStrdup(filename);
+    pkg[(slash == NULL)? 0 : slash-filename] = '\0';
+    pe = NameTableInsert(&cpe->packages, pkg);
+    if (pe->value == NULL) {
+        dirname = joinPath(cpe->path, pkg);
+        pe->value = listDirectory(dirname);
+        SafeFree(dirname);
+    }
+    SafeFree(pkg);
+    return NameTableLookup(pe->value, (slash == NULL)? filename : slash+1) != NULL;
+}
+
+
+/* Maps an archive into memory and indexes its class file members.
+   An archive which cannot be read is treated as having no members. */
+static void openArchive( ClassPathEntry *cpe ) {
+    struct stat sb;
+    uint8_t *p, *end, *limit;
+    int fd, n;
+
+    cpe->opened = 1;
+    fd = open(cpe->path, O_RDONLY);
+    if (fd < 0 || fstat(fd, &sb) != 0 || sb.st_size < 22) {
+        if (fd >= 0) close(fd);
+        fprintf(stderr, "Unable to read archive %s\n", cpe->path);
+        return;
+    }
+    cpe->size = sb.st_size;
+    cpe->data = mmap(NULL, cpe->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (cpe->data == MAP_FAILED) {
+        cpe->data = NULL;
+        fprintf(stderr, "Unable to map archive %s\n", cpe->path);
+        return;
+    }
+    /* the end record is last, followed only by a comment of up to 64K */
+    end = cpe->data + cpe->size;
+    limit = (cpe->size > 22 + 0xffff)? end - 22 - 0xffff : cpe->data;
+    for( p = end - 22;  getU4(p) != ZIP_END_RECORD;  p-- ) {
+        if (p == limit) {
+            fprintf(stderr, "Archive %s is not a zip file\n", cpe->path);
+            return;
+        }
+    }
+    n = getU2(p+10);
+    p = cpe->data + getU4(p+16);  /* start of the central directory */
+    while(n-- > 0 && p + 46 <= end && getU4(p) == ZIP_CENTRAL_HEADER) {
+        int nameLen = getU2(p+28);
+        int extraLen = getU2(p+30);
+        int commentLen = getU2(p+32);
+        char *name;
+
+        if (p + 46 + nameLen > end)
+            break;
+        name = SafeMalloc(nameLen+1);
+        memcpy(name, p+46, nameLen);
+        if (nameLen > 6 && strcmp(name+nameLen-6, ".class") == 0) {
+            ArchiveMember *am = SafeMalloc(sizeof(ArchiveMember));
+            am->method = getU2(p+10);
+            am->compressedSize = getU4(p+20);
+            am->size = getU4(p+24);
+            am->localHeaderOffset = getU4(p+42);
+            NameTableInsert(&cpe->members, name)->value = am;
+        }
+        SafeFree(name);
+        p += 46 + nameLen + extraLen + commentLen;
+    }
+}
+
+
+/* Returns a stream which reads the uncompressed contents of a member */
+static FILE *openMember( ClassPathEntry *cpe, ArchiveMember *am ) {
+    uint8_t *p = cpe->data + am->localHeaderOffset;
+    uint8_t *buffer;
+    z_stream zs;
+    FILE *f;
+
+    if (p + 30 > cpe->data + cpe->size || getU4(p) != ZIP_LOCAL_HEADER)
+        return NULL;
+    p += 30 + getU2(p+26) + getU2(p+28);
+    if (p + am->compressedSize > cpe->data + cpe->size)
+        return NULL;
+    if (am->method == ZIP_STORED)
+        return fmemopen(p, am->size, "rb");
+    if (am->method != ZIP_DEFLATED) {
+        fprintf(stderr, "Archive %s uses an unsupported compression method\n",
+            cpe->path);
+        return NULL;
+    }
+    buffer = SafeMalloc(am->size+1);
+    memset(&zs, 0, sizeof(zs));
+    zs.next_in = p;
+    zs.avail_in = am->compressedSize;
+    zs.next_out = buffer;
+    zs.avail_out = am->size;
+    if (inflateInit2(&zs, -MAX_WBITS) != Z_OK) {
+        SafeFree(buffer);
+        return NULL;
+    }
+    if (inflate(&zs, Z_FINISH) != Z_STREAM_END || zs.total_out != am->size) {
+        inflateEnd(&zs);
+        SafeFree(buffer);
+        fprintf(stderr, "Archive %s has a corrupted member\n", cpe->path);
+        return NULL;
+    }
+    inflateEnd(&zs);
+    /* the stream gets its own copy, so that it can be freed by fclose */
+    f = fmemopen(NULL, am->size+1, "w+b");
+    if (f != NULL) {
+        fwrite(buffer, 1, am->size, f);
+        rewind(f);
+    }
+    SafeFree(buffer);
+    return f;
+}
+
+
+static ArchiveMember *inArchive( ClassPathEntry *cpe, char *filename ) {
+    NameEntry *me;
+    if (!cpe->opened)
+        openArchive(cpe);
+    me = NameTableLookup(&cpe->members, filename);
+    return (me == NULL)? NULL : me->value;
+}
+
+
+/* Returns the first class path entry which holds the class file, or NULL;
+   the caller holds the lock */
+static ClassPathEntry *findClassFile( char *filename ) {
+    ClassPathEntry *cpe;
+
+    if (classPath == NULL) {
+        classPath = SafeMalloc(sizeof(ClassPathEntry));
+        classPath->path = SafeStrdup(".");
+    }
+    for( cpe = classPath;  cpe != NULL;  cpe = cpe->next ) {
+        if (cpe->isArchive? inArchive(cpe, filename) != NULL
+                          : inDirectory(cpe, filename))
+            return cpe;
+    }
+    return NULL;
+}
+
+
+static char *classFileName( char *classname ) {
+    char *filename = SafeMalloc(strlen(classname)+7);
+    strcpy(filename,classname);
+    strcat(filename,".class");
+    return filename;
+}
+
+
+/* Searches the class path entries in order; the caller holds the lock */
+static FILE *searchClassPath( char *classname, char **sourcep ) {
+    ClassPathEntry *cpe;
+    char *filename, *pathname;
+    FILE *f = NULL;
+
+    filename = classFileName(classname);
+    cpe = findClassFile(filename);
+    if (cpe != NULL) {
+        if (cpe->isArchive)
+            f = openMember(cpe, inArchive(cpe, filename));
+        else {
+            pathname = joinPath(cpe->path, filename);
+            f = fopen(pathname, "rb");
+            SafeFree(pathname);
+        }
+        if (f != NULL && sourcep != NULL)
+            *sourcep = cpe->path;
+    }
+    SafeFree(filename);
+    return f;
+}
+
+
+/* Searches the class path for the class file of the named class.
+   The result is a stream positioned at the start of the class file,
+   or NULL if no entry contains the class.  If sourcep is not NULL,
+   *sourcep is set to the class path entry where the class was found. */
+FILE *OpenClassFile( char *classname, char **sourcep ) {
+    FILE *f = NULL;
+    char *source;
+
+    pthread_mutex_lock(&classPathLock);
+    if (NameTableLookup(&missingClasses, classname) == NULL) {
+        f = searchClassPath(classname, &source);
+        if (f == NULL)
+            NameTableInsert(&missingClasses, classname);
+    }
+    pthread_mutex_unlock(&classPathLock);
+    if (f != NULL) {
+        if (tracingExecution & TRACE_CLASS_LOADS)
+            printf("found %s.class in %s\n", classname, source);
+        if (sourcep != NULL)
+            *sourcep = source;
+    }
+    return f;
+}
+
+
+/* As for OpenClassFile, except that the class is not recorded as missing
+   if the search fails and nothing is traced */
+FILE *ProbeClassFile( char *classname, char **sourcep ) {
+    FILE *f = NULL;
+
+    pthread_mutex_lock(&classPathLock);
+    if (NameTableLookup(&missingClasses, classname) == NULL)
+        f = searchClassPath(classname, sourcep);
+    pthread_mutex_unlock(&classPathLock);
+    return f;
+}
+
+
+/* Fills in *sb with the status of the file that the named class would
+   be read from: the class file itself, or the archive which holds it.
+   The result is 0 if no entry contains the class, 1 otherwise. */
+int StatClassFile( char *classname, struct stat *sb ) {
+    ClassPathEntry *cpe;
+    char *filename, *pathname;
+    int result = 0;
+
+    filename = classFileName(classname);
+    pthread_mutex_lock(&classPathLock);
+    cpe = findClassFile(filename);
+    if (cpe != NULL) {
+        pathname = cpe->isArchive? SafeStrdup(cpe->path)
+                                 : joinPath(cpe->path, filename);
+        result = stat(pathname, sb) == 0;
+        SafeFree(pathname);
+    }
+    pthread_mutex_unlock(&classPathLock);
+    SafeFree(filename);
+    return result;
+}
+
+
+/* Returns 1 if a search of the class path has already failed to
+   find the named class, 0 otherwise */
+int IsMissingClass( char *classname ) {
+    int result;
+    pthread_mutex_lock(&classPathLock);
+    result = NameTableLookup(&missingClasses, classname) != NULL;
+    pthread_mutex_unlock(&classPathLock);
+    return result;
+}
@@ -0,0 +1,16 @@
+/* ClassPath.h */
+
+#ifndef CLASSPATHH
+
+#define CLASSPATHH
+
+#include <stdio.h>  /* to define FILE */
+#include <sys/stat.h>  /* to define struct stat */
+
+extern void SetClassPath( char *path );
+extern FILE *OpenClassFile( char *classname, char **sourcep );
+extern FILE *ProbeClassFile( char *classname, char **sourcep );
+extern int StatClassFile( char *classname, struct stat *sb );
+extern int IsMissingClass( char *classname );
+
+#endif
@@ -0,0 +1,183 @@
+/* ClassPrefetch.c */
+
+/*
+   Reads class files speculatively on a pool of background threads.
+
+   Whenever a class file has been parsed, the classes named by the
+   CONSTANT_Class entries in its constant pool are queued for reading.
+   A prefetch thread takes a name from the queue, finds the class file
+   on the class path, parses it, and queues the classes which that one
+   refers to in turn.  The main thread later collects the parsed class
+   when LoadClass asks for it, so the file I/O and parsing overlap with
+   execution and with each other.
+
+   Only reading and parsing happen in the background.  Verification may
+   need other classes to be resolved, and resolving a class can run its
+   <clinit> method, so LoadClass still verifies and initializes each
+   class on the main thread when it is first used.
+
+   * StartClassPrefetch        -- creates the prefetch threads
+   * PrefetchReferencedClasses -- queues the classes that a class uses
+   * TakePrefetchedClass       -- returns the parsed class if a prefetch
+                                  thread has read it, waiting for the
+                                  thread to finish if necessary
+
+   A failed speculative read is simply discarded; the main thread then
+   reads the class itself and reports any error in the usual way.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "ClassFileFormat.h"
+#include "ReadClassFile.h"
+#include "ClassPath.h"
+#include "ClassArchive.h"
+#include "NameTable.h"
+#include "TraceOptions.h"
+#include "MyAlloc.h"
+#include "ClassPrefetch.h"
+
+typedef enum { QUEUED, READING, DONE, TAKEN } PrefetchState;
+
+typedef struct PrefetchJob {
+    char *name;                 /* the class name */
+    PrefetchState state;
+    ClassFile *cf;              /* the result, once the state is DONE */
+    char *source;               /* class path entry it came from */
+    struct PrefetchJob *next;   /* next job in the queue */
+} PrefetchJob;
+
+static int numPrefetchThreads = 0;
+static NameTable jobs;          /* every class name ever seen, to its job */
+static PrefetchJob *queueHead = NULL, *queueTail = NULL;
+static pthread_mutex_t prefetchLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t workAvailable = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t jobDone = PTHREAD_COND_INITIALIZER;
+
+
+/* Queues the classes referenced from the constant pool of cf which have
+   not been seen before; the caller holds the lock */
+static void queueReferences( ClassFile *cf ) {
+    int i;
+    for( i = 1;  i < cf->constant_pool_count;  i++ ) {
+        char *name;
+        NameEntry *ne;
+        PrefetchJob *job;
+
+        if (cf->cp_tag[i] != CP_Class)
+            continue;
+        name = (char *)(cf->cp_item[cf->cp_item[i].ival].sval+2);
+        // arrays are not read from files, nor are library classes
+        if (name[0] == '[' || strncmp(name, "java/", 5) == 0)
+            continue;
+        if (IsArchivedClass(name))
+            continue;
+        ne = NameTableInsert(&jobs, name);
+        if (ne->value != NULL)
+            continue;
+        job = SafeMalloc(sizeof(PrefetchJob));
+        job->name = ne->name;
+        job->state = QUEUED;
+        ne->value = job;
+        if (queueTail == NULL)
+            queueHead = job;
+        else
+            queueTail->next = job;
+        queueTail = job;
+        pthread_cond_signal(&workAvailable);
+    }
+}
+
+
+static void *prefetchThread( void *arg ) {
+    PrefetchJob *job;
+    FILE *f;
+
+    pthread_mutex_lock(&prefetchLock);
+    for( ; ; ) {
+        while(queueHead == NULL)
+            pthread_cond_wait(&workAvailable, &prefetchLock);
+        job = queueHead;
+        queueHead = job->next;
+        if (queueHead == NULL)
+            queueTail = NULL;
+        if (job->state != QUEUED)
+            continue;  // the main thread took it first
+        job->state = READING;
+        pthread_mutex_unlock(&prefetchLock);
+
+        f = ProbeClassFile(job->name, &job->source);
+        job->cf = (f == NULL)? NULL : ParseClassFile(f);
+
+        pthread_mutex_lock(&prefetchLock);
+        job->state = DONE;
+        pthread_cond_broadcast(&jobDone);
+        if (job->cf != NULL)
+            queueReferences(job->cf);
+    }
+    return NULL;
+}
+
+
+/* Creates numThreads prefetch threads; with none, classes are only
+   ever read when they are needed */
+void StartClassPrefetch( int numThreads ) {
+    pthread_t tid;
+    int i;
+
+    for( i = 0;  i < numThreads;  i++ ) {
+        if (pthread_create(&tid, NULL, prefetchThread, NULL) != 0) {
+            fprintf(stderr, "Unable to create class prefetch thread\n");
+            break;
+        }
+        pthread_detach(tid);
+        numPrefetchThreads++;
+    }
+}
+
+
+/* Queues the classes used by cf so that they can be read in the background */
+void PrefetchReferencedClasses( ClassFile *cf ) {
+    if (numPrefetchThreads == 0)
+        return;
+    pthread_mutex_lock(&prefetchLock);
+    queueReferences(cf);
+    pthread_mutex_unlock(&prefetchLock);
+}
+
+
+/* Returns the parsed class file for classname if a prefetch thread has
+   read it, or NULL if the caller must read it.  Each class is handed
+   over at most once. */
+ClassFile *TakePrefetchedClass( char *classname ) {
+    NameEntry *ne;
+    PrefetchJob *job;
+    ClassFile *cf = NULL;
+
+    if (numPrefetchThreads == 0)
+        return NULL;
+    pthread_mutex_lock(&prefetchLock);
+    ne = NameTableInsert(&jobs, classname);
+    job = ne->value;
+    if (job == NULL) {
+        // never queued; make sure that it never will be
+        job = SafeMalloc(sizeof(PrefetchJob));
+        job->name = ne->name;
+        ne->value = job;
+    } else {
+        // a queued job is cheaper to read here than to wait for
+        while(job->state == READING)
+            pthread_cond_wait(&jobDone, &prefetchLock);
+        if (job->state == DONE)
+            cf = job->cf;
+    }
+    job->state = TAKEN;
+    pthread_mutex_unlock(&prefetchLock);
+    if (cf != NULL && (tracingExecution & TRACE_CLASS_LOADS))
+        printf("found %s.class in %s (prefetched)\n", classname, job->source);
+    return cf;
+}
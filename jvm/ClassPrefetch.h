@@ -0,0 +1,13 @@
+/* ClassPrefetch.h */
+
+#ifndef CLASSPREFETCHH
+
+#define CLASSPREFETCHH
+
+#include "ClassFileFormat.h"  /* to define ClassFile type */
+
+extern void StartClassPrefetch( int numThreads );
+extern void PrefetchReferencedClasses( ClassFile *cf );
+extern ClassFile *TakePrefetchedClass( char *classname );
+
+#endif
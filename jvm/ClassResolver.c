@@ -13,6 +13,7 @@
    * InvokeVirtualMethod -- implements JVM op invokevirtual
 
    * LoadClass  -- attempts to load a class from a disk file
+   * BuildReferenceMaps -- records which fields of a class hold references
 
    * GetStatic  -- implements JVM op getstatic
    * PutStatic  -- implements JVM op getstatic
@@ -28,11 +29,13 @@
 
 #include "ClassFileFormat.h"
 #include "ReadClassFile.h"
+#include "ClassPath.h"
 #include "jvm.h"
 #include "InterpretLoop.h"
 #include "NativeClasses.h"
 #include "TraceOptions.h"
 #include "MyAlloc.h"
+#include "StartupStats.h"
 #include "ClassResolver.h"
 
 ClassType *FirstLoadedClass = NULL;  /* list of loaded classes or array types in use */
@@ -62,22 +65,70 @@ static void getNumClassVars( ClassFile *cf, int *numClassVars, int *numInstVars
 }
 
 
+/* Sets the bits in map for the static fields (if isStatic is true) or
+   the instance fields declared by cf which hold references; the first
+   field is at position slot */
+static void setReferenceBits( uint32_t *map, ClassFile *cf, int isStatic, int slot ) {
+    int n = cf->fields_count;
+    field_info *fp = cf->fields;
+    char c;
+
+    while(n-- > 0) {
+        field_info *cfp = fp++;
+        if (((cfp->access_flags & ACC_STATIC) != 0) != isStatic)
+            continue;
+        c = cf->cp_item[cfp->descriptor_index].sval[2];
+        if (c == 'L' || c == '[')
+            map[slot/32] |= 1 << (slot%32);
+        slot += (c == 'D' || c == 'J')? 2 : 1;
+    }
+}
+
+
+/* Builds the maps of the static fields and instance fields of the class
+   ct which hold references, for the garbage collector.  The instance
+   fields include those declared in the parent classes. */
+void BuildReferenceMaps( ClassType *ct ) {
+    ClassType *pct;
+    int numClassVars, numInstVars;
+
+    getNumClassVars(ct->cf, &numClassVars, &numInstVars);
+    ct->numClassFields = numClassVars;
+    ct->classRefMap = SafeCalloc(numClassVars/32 + 1, sizeof(uint32_t));
+    setReferenceBits(ct->classRefMap, ct->cf, 1, 0);
+    ct->instanceRefMap = SafeCalloc(ct->numInstanceFields/32 + 1, sizeof(uint32_t));
+    for( pct = ct;  pct != NULL;  pct = pct->parent )
+        setReferenceBits(ct->instanceRefMap, pct->cf, 0,
+            (pct->parent != NULL)? pct->parent->numInstanceFields : 0);
+}
+
+
 /* Invoke a method whose class has been resolved and the
    method implementation identified */
 void InvokeMethod( ClassType *ct, method_info *m, int isStatic ) {
     int i;
     int rw;
     uint32_t result1, result2;
+    JVM_Frame frame;
 
     if (ct == NULL) {
         if (!isStatic) (void)JVM_Pop();
         return;
     }
+    if (m->body != NULL)
+        MaterializeMethod(ct->cf, m);
     DataItem *locals = JVM_Top + 1 - m->nArgs;  /* points locals at first arg */
 
     for( i = m->nArgs;  i < m->max_locals;  i++ )
         JVM_Push(0);
+    frame.caller = JVM_CurrentFrame;
+    frame.thisClass = ct;
+    frame.method = m;
+    frame.localVariable = locals;
+    frame.pcp = NULL;  /* set by InterpretMethod */
+    JVM_CurrentFrame = &frame;
     rw = InterpretMethod(ct, m, locals);
+    JVM_CurrentFrame = frame.caller;
     /* pop the method result (if any) off the stack */
     if (rw > 0) {
         result1 = JVM_Pop();
@@ -169,7 +220,7 @@ static void GeneralInvoke( ClassType *ct, int ix, int isStatic,
         DataItem *objRef = JVM_Top - argSize;
         ClassInstance *theObj = REAL_HEAP_POINTER(objRef->pval);
         assert(theObj->kind == CODE_INST);
-        ct1 = theObj->thisClass;  // ct1 is the dynamic type of theObj
+        ct1 = INSTANCE_CLASS(theObj);  // ct1 is the dynamic type of theObj
     }
     while(ct1 != NULL) {
         /* now we have to find the matching method in the ct1 class */
@@ -226,20 +277,20 @@ void InvokeVirtualMethod( ClassType *ct, int ix ) {
 /* Given a type descriptor for a class type or an array type, this
    function finds or creates, if necessary, an instance of the
    ClassType struct which describes the datatype. */
-ClassType *ResolveClassReferenceByName( char *cname ) {
+static ClassType *resolveClassByName( char *cname ) {
     ClassType *ct1;
 
     if (strcmp(cname,"java/lang/Object") == 0)
         return NULL;
     if (cname[0] == '[') {
-        ClassType *cta = ResolveClassReferenceByName(cname+1);
+        ClassType *cta = resolveClassByName(cname+1);
         for( ct1 = FirstLoadedClass;  ct1 != NULL;  ct1 = ct1->nextClass ) {
             if (!ct1->isArrayType) continue;
             if (cta == ct1->elementType) {  /* already created */
                 return ct1;
             }
         }
-        ct1 = MyHeapAlloc(sizeof(ClassType));
+        ct1 = MetaspaceAlloc(sizeof(ClassType));
         ct1->kind = CODE_CLAS;
         ct1->typeDescriptor = SafeStrdup(cname);
         ct1->isArrayType = 1;
@@ -248,7 +299,9 @@ ClassType *ResolveClassReferenceByName( char *cname ) {
         FirstLoadedClass = ct1;
         return ct1;
     }
-    // it's a class type
+    // it's a class type; those already known to be unavailable fail quickly
+    if (strncmp(cname, "java/", 5) == 0 || IsMissingClass(cname))
+        return NULL;
     for( ct1 = FirstLoadedClass;  ct1 != NULL;  ct1 = ct1->nextClass ) {
         if (ct1->isArrayType) continue;
         if (strcmp(cname,ct1->cf->cname) == 0) {  /* already loaded */
@@ -259,6 +312,20 @@ ClassType *ResolveClassReferenceByName( char *cname ) {
     return ct1;
 }
 
+
+/* As above; the time taken is recorded if -Xstartup-stats is in effect */
+ClassType *ResolveClassReferenceByName( char *cname ) {
+    ClassType *ct1;
+    uint64_t startTime;
+
+    if (!startupStats)
+        return resolveClassByName(cname);
+    startTime = StartupClock();
+    ct1 = resolveClassByName(cname);
+    RecordStartupTime(PHASE_RESOLVE, cname, StartupClock() - startTime);
+    return ct1;
+}
+
 /* i must be the index of a Class item or an array type in the
    constant pool of the class identified by ct.
    If it is a Class item and the class has not been loaded, we
@@ -281,12 +348,9 @@ ClassType *ResolveClassReference( ClassType *ct, int ix ) {
 
 
 /* Given the name of a class, we attempt to read it into memory
-   from the current directory on the disk.
+   from a directory or jar file on the class path.
    The result is a ClassType instance for this class, or
    NULL if the class cannot be found.
-
-   Note: jar files are not supported.  This function cannot search
-   for a class inside a jar file.
 */
 ClassType *LoadClass( char *cname ) {
     ClassType *ct1;
@@ -312,12 +376,12 @@ ClassType *LoadClass( char *cname ) {
     if (tracingExecution & TRACE_CLASS_LOADS)
         printf("loading class %s\n", cname);
 
-    /* At this point, the bytecode needs to be verified */
-    Verify(cf);
-    
+    /* Each method's bytecode is verified when the method is first
+       invoked (see MaterializeMethod), not here */
+
     getNumClassVars(cf, &numClassVars, &numInstVars);
-    // The class itself would be allocated in the Method Area of a real JVM.
-    ct1 = MyHeapAlloc(sizeof(ClassType)+(numClassVars-1)*sizeof(DataItem));
+    // The class itself is allocated in the metaspace, outside the heap
+    ct1 = MetaspaceAlloc(sizeof(ClassType)+(numClassVars-1)*sizeof(DataItem));
     ct1->kind = CODE_CLAS;
     ct1->typeDescriptor = SafeStrdup(cname);
     ct1->cf = cf;
@@ -325,6 +389,7 @@ ClassType *LoadClass( char *cname ) {
     ct1->numInstanceFields = numInstVars;
     if (pct != NULL)
         ct1->numInstanceFields += pct->numInstanceFields;
+    BuildReferenceMaps(ct1);
     ct1->nextClass = FirstLoadedClass;
     FirstLoadedClass = ct1;
 
@@ -341,8 +406,12 @@ ClassType *LoadClass( char *cname ) {
 
     /* Finally, we execute the <clinit> static method */
     m = SearchClassForMethodByName(cf, "<clinit>", "()V");
-    if (m != NULL)  // initialize class variables via call to clinit
+    if (m != NULL) {  // initialize class variables via call to clinit
+        uint64_t startTime = startupStats? StartupClock() : 0;
         InvokeMethod(ct1,m,1);
+        if (startupStats)
+            RecordStartupTime(PHASE_CLINIT, cname, StartupClock() - startTime);
+    }
 
     return ct1;
 }
@@ -412,6 +481,8 @@ static int getOrPutStatic( ClassType *ct, int ix, int doAGet ) {
                 } else {
                     if (itsTwoWords)
                         ct1->classField[fieldCount+1].uval = JVM_Pop();
+                    /* no barrier is needed, as the static fields
+                       are roots which every collection scans */
                     ct1->classField[fieldCount].uval = JVM_Pop();
                 }
                 return 1;
@@ -440,7 +511,7 @@ static int getOrPutStatic( ClassType *ct, int ix, int doAGet ) {
 static int getOrPutField( ClassType *ct, int ix, int doAGet ) {
     ClassType *ct1;
     ClassFile *cf;
-    int ntix, fnameIx, ftypeIx, itsTwoWords;
+    int ntix, fnameIx, ftypeIx, itsTwoWords, itsAReference;
     char c;
     char *fname;  /* the field name */
 
@@ -452,6 +523,7 @@ static int getOrPutField( ClassType *ct, int ix, int doAGet ) {
     ftypeIx = cf->cp_item[ntix].ss.sval2;
     c = cf->cp_item[ftypeIx].sval[2]; /* c = first char of type descriptor */
     itsTwoWords = (c == 'D' || c == 'J');
+    itsAReference = (c == 'L' || c == '[');
     fname = (char *)(cf->cp_item[fnameIx].sval+2);
     if (tracingExecution & TRACE_FIELDS)
         fprintf(stdout,"%s access to instance field %s\n",
@@ -490,7 +562,11 @@ static int getOrPutField( ClassType *ct, int ix, int doAGet ) {
                 } else {
                     uint32_t v1 = JVM_Pop();
                     objRef = REAL_HEAP_POINTER(JVM_PopReference());
+                    if (itsAReference)
+                        SATB_BARRIER(&objRef->instField[fieldCount].pval);
                     objRef->instField[fieldCount].uval = v1;
+                    if (itsAReference)
+                        WRITE_BARRIER(objRef);
                 }
                 return 1;
             }
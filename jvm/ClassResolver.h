@@ -20,6 +20,7 @@ extern ClassType *ResolveClassReference( ClassType *ct, int ix );
 extern ClassType *ResolveClassReferenceByName( char *name );
 
 extern ClassType *LoadClass( char *cname );
+extern void BuildReferenceMaps( ClassType *ct );
 
 extern int GetStatic(ClassType *ct, int ix);
 extern int GetField(ClassType *ct, int ix);
@@ -0,0 +1,385 @@
+/* HeapSnapshot.c */
+
+/*
+   Saves the state of the JVM after the main class has been loaded and
+   initialized, and restores it in a later run.
+
+   A run with the -Xcheckpoint:file option writes a snapshot once the
+   main class, and the classes that its <clinit> method used, have been
+   loaded and initialized.  A run with -Xrestore:file maps the snapshot
+   and goes straight on to call the main method, without running any
+   class initializers.
+
+   * WriteHeapSnapshot   -- writes the heap and the loaded classes
+   * RestoreHeapSnapshot -- reinstates them
+
+   The snapshot holds a copy of the whole Java heap, and of the used part
+   of the metaspace, where the classes are.  References between Java
+   objects are offsets in the heap (HeapPointer values), and the
+   metaspace is at the same offset as before, so most of the copy is
+   used exactly as it was saved.  The exceptions are the fields which
+   hold C pointers:
+     - pointers from one class to another (the ClassType links) are
+       adjusted by the distance between the old and new heap addresses;
+     - strings held outside the heap (ClassType.typeDescriptor and a
+       StringBuilder's buffer) are saved after the heap copy and are
+       copied back into new storage;
+     - ClassType.cf is found again by reading the class, which normally
+       comes straight from the shared class archive, and the reference
+       maps of the class are built again from it;
+     - the interned strings are saved as a list of references, and are
+       interned again, so that the string constants that the classes
+       resolve afresh are the same objects as before.
+   Each class file's size and modification time are saved too; if any
+   has changed, the snapshot is ignored and the program starts normally.
+
+   The objects in the large object space are saved after the heap copy,
+   and are copied back to the same offsets.  The heap size is taken from
+   the snapshot, as is the size it may grow to.
+
+   Layout of the snapshot file:
+       SnapshotHeader
+       heap copy, starting at a page boundary
+       metaspace copy
+       SavedLargeObject records, each followed by the object
+       SavedString records, each followed by its characters
+       references to the interned strings
+       SavedClass records, the first being the main class
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "ClassFileFormat.h"
+#include "ReadClassFile.h"
+#include "ClassPath.h"
+#include "ClassResolver.h"
+#include "jvm.h"
+#include "TraceOptions.h"
+#include "MyAlloc.h"
+#include "NativeClasses.h"
+#include "HeapSnapshot.h"
+
+#define SNAPSHOTMAGIC   "MyJVMsnp"
+#define SNAPSHOTVERSION 11
+
+typedef struct {
+    char     magic[8];
+    uint32_t version;
+    uint32_t referenceShift;    /* HEAPREFSHIFT of the JVM which saved it */
+    uint64_t heapSize;
+    uint64_t maxHeapSize;       /* the heap may grow to this size */
+    HeapPointer firstLoadedClass;
+    HeapPointer fakeSystemOut;
+    uint32_t numStrings;
+    uint32_t numClasses;
+    uint32_t numLargeObjects;
+    uint32_t metaspaceSize;     /* bytes of the metaspace in use */
+    uint32_t numInterned;
+    uint64_t oldHeapStart;      /* address of the heap when it was saved */
+} SnapshotHeader;
+
+typedef struct {
+    HeapPointer object;         /* a reference to the object */
+    uint32_t size;              /* bytes saved, from the size field on */
+} SavedLargeObject;
+
+typedef struct {
+    HeapPointer object;         /* the object which refers to the string */
+    uint32_t length;            /* number of bytes saved */
+    uint32_t capacity;          /* number of bytes to allocate */
+} SavedString;
+
+typedef struct {
+    char     name[256];
+    HeapPointer classType;
+    int64_t  fileSize;
+    int64_t  mtimeSec;
+    int64_t  mtimeNsec;
+} SavedClass;
+
+static FILE *snapshotFile;
+static int numStrings;
+static int numLargeObjects;
+static int numInterned;
+static intptr_t heapDelta;
+
+
+/* Returns the field of a heap object, or a class, which refers to a
+   string outside the heap, or NULL */
+static char **stringField( void *obj ) {
+    switch(*(uint32_t*)obj) {
+    case CODE_CLAS:
+        return &((ClassType*)obj)->typeDescriptor;
+    case CODE_SBLD:
+        return &((StringBuilderInstance*)obj)->buffer;
+    }
+    return NULL;
+}
+
+
+static void saveLargeObject( void *obj ) {
+    SavedLargeObject slo;
+
+    if ((uint8_t*)obj < LosStart)
+        return;
+    slo.object = MAKE_HEAP_REFERENCE(obj);
+    slo.size = *((uint32_t*)obj - 1);
+    fwrite(&slo, sizeof(slo), 1, snapshotFile);
+    fwrite((uint32_t*)obj - 1, 1, slo.size, snapshotFile);
+    numLargeObjects++;
+}
+
+
+static void saveString( void *obj ) {
+    char **fp = stringField(obj);
+    SavedString ss;
+
+    if (fp == NULL || *fp == NULL)
+        return;
+    ss.object = MAKE_HEAP_REFERENCE(obj);
+    ss.length = strlen(*fp) + 1;
+    ss.capacity = ss.length;
+    if (*(uint32_t*)obj == CODE_SBLD
+            && ((StringBuilderInstance*)obj)->capacity > ss.capacity)
+        ss.capacity = ((StringBuilderInstance*)obj)->capacity;
+    fwrite(&ss, sizeof(ss), 1, snapshotFile);
+    fwrite(*fp, 1, ss.length, snapshotFile);
+    numStrings++;
+}
+
+
+static void saveInterned( HeapPointer *slot ) {
+    fwrite(slot, sizeof(HeapPointer), 1, snapshotFile);
+    numInterned++;
+}
+
+
+static int saveClass( ClassType *ct ) {
+    SavedClass sc;
+    struct stat sb;
+
+    memset(&sc, 0, sizeof(sc));
+    if (strlen(ct->typeDescriptor) >= sizeof(sc.name)
+            || !StatClassFile(ct->typeDescriptor, &sb)) {
+        fprintf(stderr, "Unable to save class %s in heap snapshot\n",
+            ct->typeDescriptor);
+        return 0;
+    }
+    strcpy(sc.name, ct->typeDescriptor);
+    sc.classType = MAKE_HEAP_REFERENCE(ct);
+    sc.fileSize = sb.st_size;
+    sc.mtimeSec = sb.st_mtim.tv_sec;
+    sc.mtimeNsec = sb.st_mtim.tv_nsec;
+    fwrite(&sc, sizeof(sc), 1, snapshotFile);
+    return 1;
+}
+
+
+/* Writes a snapshot of the heap and loaded classes to path.  The JVM
+   stack must be empty, so that the heap holds the whole state. */
+void WriteHeapSnapshot( char *path, ClassType *mainClass ) {
+    SnapshotHeader hdr;
+    ClassType *ct;
+    int numClasses = 0;
+
+    snapshotFile = fopen(path, "wb");
+    if (snapshotFile == NULL) {
+        fprintf(stderr, "Unable to create heap snapshot %s\n", path);
+        exit(1);
+    }
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, SNAPSHOTMAGIC, 8);
+    hdr.version = SNAPSHOTVERSION;
+    hdr.heapSize = HeapEnd - HeapStart;
+    hdr.maxHeapSize = MaxHeapSize;
+    hdr.referenceShift = HEAPREFSHIFT;
+    hdr.firstLoadedClass = MAKE_HEAP_REFERENCE(FirstLoadedClass);
+    hdr.fakeSystemOut = MAKE_HEAP_REFERENCE(Fake_System_Out);
+    hdr.oldHeapStart = (uintptr_t)HeapStart;
+    hdr.metaspaceSize = MetaspaceTop - MetaspaceStart;
+
+    fseek(snapshotFile, sysconf(_SC_PAGESIZE), SEEK_SET);
+    fwrite(HeapStart, 1, hdr.heapSize, snapshotFile);
+    fwrite(MetaspaceStart, 1, hdr.metaspaceSize, snapshotFile);
+    numLargeObjects = 0;
+    ForEachHeapObject(saveLargeObject);
+    hdr.numLargeObjects = numLargeObjects;
+    numStrings = 0;
+    ForEachHeapObject(saveString);
+    for( ct = FirstLoadedClass;  ct != NULL;  ct = ct->nextClass )
+        saveString(ct);
+    hdr.numStrings = numStrings;
+    numInterned = 0;
+    ForEachInternedString(saveInterned);
+    hdr.numInterned = numInterned;
+    if (!saveClass(mainClass))
+        exit(1);
+    for( ct = FirstLoadedClass;  ct != NULL;  ct = ct->nextClass ) {
+        if (ct->isArrayType || ct == mainClass)
+            continue;
+        if (!saveClass(ct))
+            exit(1);
+        numClasses++;
+    }
+    hdr.numClasses = numClasses + 1;
+    rewind(snapshotFile);
+    fwrite(&hdr, sizeof(hdr), 1, snapshotFile);
+    if (fclose(snapshotFile) != 0) {
+        fprintf(stderr, "Unable to write heap snapshot %s\n", path);
+        exit(1);
+    }
+    if (tracingExecution & TRACE_HEAP)
+        printf("heap snapshot with %d classes written to %s\n",
+            hdr.numClasses, path);
+}
+
+
+static void *relocate( void *p ) {
+    return (p == NULL)? NULL : (uint8_t*)p + heapDelta;
+}
+
+
+/* Adjusts the pointers in one object for the new heap address */
+static void relocateObject( void *obj ) {
+    char **fp = stringField(obj);
+    if (fp != NULL)
+        *fp = NULL;  // restored later, if there was a string
+}
+
+
+/* Adjusts the pointers in one class for the new metaspace address */
+static void relocateClass( ClassType *ct ) {
+    ct->nextClass = relocate(ct->nextClass);
+    ct->elementType = relocate(ct->elementType);
+    ct->parent = relocate(ct->parent);
+    ct->typeDescriptor = NULL;  // restored with the other strings
+    ct->cf = NULL;
+    ct->instanceRefMap = ct->classRefMap = NULL;
+    ct->stringConstants = NULL;  // resolved again when used
+}
+
+
+/* Reinstates the heap and the loaded classes from the snapshot at path.
+   The result is the main class, or NULL if the snapshot cannot be used
+   with the named main class; nothing has been changed in that case. */
+ClassType *RestoreHeapSnapshot( char *path, char *classname ) {
+    SnapshotHeader hdr;
+    SavedLargeObject *slo;
+    SavedString *ss;
+    SavedClass *sc;
+    struct stat sb;
+    uint8_t *heap, *saved, *p;
+    long savedSize, pageSize = sysconf(_SC_PAGESIZE);
+    ClassType *ct;
+    FILE *f;
+    int i;
+
+    f = fopen(path, "rb");
+    if (f == NULL) {
+        fprintf(stderr, "Unable to open heap snapshot %s\n", path);
+        return NULL;
+    }
+    if (fread(&hdr, sizeof(hdr), 1, f) != 1
+            || memcmp(hdr.magic, SNAPSHOTMAGIC, 8) != 0
+            || hdr.version != SNAPSHOTVERSION
+            || hdr.referenceShift != HEAPREFSHIFT) {
+        fprintf(stderr, "File %s is not a heap snapshot\n", path);
+        fclose(f);
+        return NULL;
+    }
+    /* read the objects, strings and classes which follow the heap copy */
+    fseek(f, 0, SEEK_END);
+    savedSize = ftell(f) - pageSize - hdr.heapSize;
+    if (savedSize < (long)(hdr.metaspaceSize + hdr.numClasses*sizeof(SavedClass))) {
+        fprintf(stderr, "Heap snapshot %s is truncated\n", path);
+        fclose(f);
+        return NULL;
+    }
+    saved = SafeMalloc(savedSize);
+    fseek(f, pageSize + hdr.heapSize, SEEK_SET);
+    fread(saved, 1, savedSize, f);
+    sc = (SavedClass*)(saved + savedSize - hdr.numClasses*sizeof(SavedClass));
+    if (strcmp(sc[0].name, classname) != 0) {
+        fprintf(stderr, "Heap snapshot %s was made for class %s\n",
+            path, sc[0].name);
+        SafeFree(saved);
+        fclose(f);
+        return NULL;
+    }
+    for( i = 0;  i < hdr.numClasses;  i++ ) {
+        if (!StatClassFile(sc[i].name, &sb) || sb.st_size != sc[i].fileSize
+                || sb.st_mtim.tv_sec != sc[i].mtimeSec
+                || sb.st_mtim.tv_nsec != sc[i].mtimeNsec) {
+            if (showWarnings)
+                fprintf(stderr, "Warning: heap snapshot %s is out of date "
+                    "(class %s has changed)\n", path, sc[i].name);
+            SafeFree(saved);
+            fclose(f);
+            return NULL;
+        }
+    }
+
+    /* pages of the heap are copied only when written; the large object
+       space must follow it as before, so it may grow as before too */
+    MaxHeapSize = hdr.maxHeapSize;
+    heap = ReserveHeap(hdr.heapSize);
+    heap = mmap(heap, hdr.heapSize, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_FIXED,
+        fileno(f), pageSize);
+    fclose(f);
+    if (heap == MAP_FAILED) {
+        fprintf(stderr, "Unable to map heap snapshot %s\n", path);
+        SafeFree(saved);
+        return NULL;
+    }
+    AdoptHeap(heap, hdr.heapSize);
+    heapDelta = (intptr_t)heap - (intptr_t)hdr.oldHeapStart;
+    memcpy(AdoptMetaspace(hdr.metaspaceSize), saved, hdr.metaspaceSize);
+    for( p = saved + hdr.metaspaceSize, i = 0;  i < hdr.numLargeObjects;  i++ ) {
+        slo = (SavedLargeObject*)p;
+        p += sizeof(SavedLargeObject);
+        memcpy(AdoptLargeObject(slo->object, slo->size), p, slo->size);
+        p += slo->size;
+    }
+    ForEachHeapObject(relocateObject);
+    FirstLoadedClass = REAL_HEAP_POINTER(hdr.firstLoadedClass);
+    for( ct = FirstLoadedClass;  ct != NULL;  ct = ct->nextClass )
+        relocateClass(ct);
+    for( i = 0;  i < hdr.numStrings;  i++ ) {
+        char *s;
+        ss = (SavedString*)p;
+        p += sizeof(SavedString);
+        s = SafeMalloc(ss->capacity);
+        memcpy(s, p, ss->length);
+        *stringField(REAL_HEAP_POINTER(ss->object)) = s;
+        p += ss->length;
+    }
+    for( i = 0;  i < hdr.numInterned;  i++ ) {
+        InternString(REAL_HEAP_POINTER(*(HeapPointer*)p));
+        p += sizeof(HeapPointer);
+    }
+    Fake_System_Out = REAL_HEAP_POINTER(hdr.fakeSystemOut);
+    for( i = 0;  i < hdr.numClasses;  i++ ) {
+        ct = REAL_HEAP_POINTER(sc[i].classType);
+        ct->cf = ReadClassFile(ct->typeDescriptor);
+        if (ct->cf == NULL) {
+            fprintf(stderr, "Unable to restore class %s from heap snapshot\n",
+                ct->typeDescriptor);
+            exit(1);
+        }
+    }
+    /* the instance maps need the parent classes' files */
+    for( i = 0;  i < hdr.numClasses;  i++ )
+        BuildReferenceMaps(REAL_HEAP_POINTER(sc[i].classType));
+    ct = REAL_HEAP_POINTER(sc[0].classType);
+    SafeFree(saved);
+    if (tracingExecution & TRACE_HEAP)
+        printf("heap snapshot with %d classes restored from %s\n",
+            hdr.numClasses, path);
+    return ct;
+}
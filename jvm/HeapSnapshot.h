@@ -0,0 +1,12 @@
+/* HeapSnapshot.h */
+
+#ifndef HEAPSNAPSHOTH
+
+#define HEAPSNAPSHOTH
+
+#include "jvm.h"  /* to define ClassType */
+
+extern void WriteHeapSnapshot( char *path, ClassType *mainClass );
+extern ClassType *RestoreHeapSnapshot( char *path, char *classname );
+
+#endif
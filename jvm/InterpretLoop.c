@@ -25,6 +25,7 @@
 #include "TraceOptions.h"
 #include "ClassResolver.h"
 #include "StringBuilder.h"
+#include "NativeClasses.h"
 #include "MyAlloc.h"
 #include "InterpretLoop.h"
 
@@ -81,8 +82,7 @@ static uint16_t uget2( uint8_t **pcp ) {
    of the constant to push onto the stack.
 */
 void  PushConstant( ClassType *thisClass, int i ) {
-    StringInstance *p;
-    char *s;
+    uint8_t *s;
     ConstantPoolItem *cpi = &thisClass->cf->cp_item[i];
 
     switch(thisClass->cf->cp_tag[i]) {
@@ -93,11 +93,18 @@ void  PushConstant( ClassType *thisClass, int i ) {
         JVM_PushFloat(cpi->fval);
         break;
     case CP_String:
-        s = GetCPItemAsString(thisClass->cf,i);
-        p = MyHeapAlloc(sizeof(StringInstance));
-        p->kind = CODE_STRG;
-        p->sval = s;
-        JVM_PushReference(MAKE_HEAP_REFERENCE(p));
+        /* each string constant is interned when it is first used, and
+           the class keeps it for the next time */
+        if (thisClass->stringConstants == NULL)
+            thisClass->stringConstants =
+                SafeCalloc(thisClass->cf->constant_pool_count, sizeof(HeapPointer));
+        if (thisClass->stringConstants[i] == NULL_HEAP_REFERENCE) {
+            /* the characters are those of the UTF8 item, after its length */
+            s = thisClass->cf->cp_item[cpi->ival].sval;
+            thisClass->stringConstants[i] = MAKE_HEAP_REFERENCE(
+                InternString(NewString((char*)s+2, (s[0] << 8) | s[1])));
+        }
+        JVM_PushReference(thisClass->stringConstants[i]);
         break;
     default:
         fprintf(stderr, "invalid index into constant pool for PushConstant\n");
@@ -130,6 +137,7 @@ int InterpretMethod( ClassType *thisClass, method_info *method, DataItem *localV
     union { int64_t lval;  double dval;  int32_t ival[2];  uint32_t uval[2]; } pair;
 
 	pc = code = method->code;
+    JVM_CurrentFrame->pcp = &pc;  /* for the garbage collector */
     for( ; ; ) {
         uint8_t op = *pc++;
         if (tracingExecution & TRACE_OPS)
@@ -159,7 +167,9 @@ int InterpretMethod( ClassType *thisClass, method_info *method, DataItem *localV
             arr = REAL_HEAP_POINTER(aHeapReference);
             if (i<0 || i>=arr->size)
                 throwException("ArrayIndexOutOfBoundsException",pc,method,thisClass);
+            SATB_BARRIER(&arr->elements[i]);
             arr->elements[i] = anotherHeapRef;
+            WRITE_BARRIER(arr);
             break;
         case OP_aconst_null:
             /*  --> null 	pushes a null reference onto the stack */
@@ -1263,10 +1273,10 @@ int InterpretMethod( ClassType *thisClass, method_info *method, DataItem *localV
                 }
 				free(cn);
             } else {
-                aClassInstance = MyHeapAlloc(sizeof(ClassInstance)+
-                        (aClassType->numInstanceFields-1)*sizeof(DataItem));
+                aClassInstance = MyHeapAlloc(
+                        INSTANCE_SIZE(aClassType->numInstanceFields));
                 aClassInstance->kind = CODE_INST;
-                aClassInstance->thisClass = aClassType;
+                aClassInstance->classRef = MAKE_HEAP_REFERENCE(aClassType);
             }
             JVM_PushReference(MAKE_HEAP_REFERENCE(aClassInstance));
             break;
@@ -13,32 +13,74 @@
    is not exhausted and zeroes out any returned memory.
    
    Java Heap Management Functions:
-   * InitMyAlloc  -- initializes the Java heap before execution starts
+   * InitMyAlloc  -- initializes the Java heap before execution starts;
+                     the heap grows and shrinks in place after that, up to
+                     MaxHeapSize bytes
    * MyHeapAlloc  -- returns a block of memory from the Java heap
-   * gc           -- the System.gc garbage collector
+   * gc           -- the System.gc garbage collector, a mostly-copying
+                     collector which moves the live objects off sparsely
+                     occupied pages so that they can be allocated from
+                     again by bumping a pointer; it marks, and sweeps
+                     when it evacuates, with ParallelGCThreads threads,
+                     and otherwise leaves the sweep to MyHeapAlloc, a
+                     chunk at a time; once swept, the pages of large
+                     free blocks are returned to the OS
+   * minorGc      -- collects just the nursery, where small objects are
+                     allocated, promoting the survivors to the old space
    * MyHeapFree   -- to be called only by gc()!!
    * PrintHeapUsageStatistics  -- does as the name suggests
+   * ForEachHeapObject -- visits every object in the heap
+   * ReserveHeap  -- reserves the address space for the heap, the
+                     metaspace and the large object space which follow it
+   * AdoptHeap    -- allows the heap to be restored by HeapSnapshot.c
+   * AdoptLargeObject -- allows a large object to be restored likewise
+   * MetaspaceAlloc -- returns storage for a class, which is never freed
+   * AdoptMetaspace -- allows the metaspace to be restored likewise
 
    General Storage Functions:
    * SafeMalloc  -- used like malloc
    * SafeCalloc  -- used like calloc
    * SafeStrdup  -- used like strdup
    * SafeFree    -- used like free
+   * NewArena    -- creates an arena, for storage freed all at once
+   * ArenaAlloc  -- used like calloc, but allocates from an arena
+   * FreeArena   -- releases all of an arena's storage
 */
 
+#define _GNU_SOURCE     /* for pthread_getattr_np */
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
+#include <setjmp.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <time.h>
 
 #include "ClassFileFormat.h"
 #include "ClassResolver.h"
 #include "TraceOptions.h"
 #include "MyAlloc.h"
+#include "StackMaps.h"
+#include "NativeClasses.h"
 #include "jvm.h"
 
+/* all blocks are a multiple of this size */
+#define HEAPALIGN 8
+
+/* Within this module the position of a block is given by a HeapOffset,
+   its offset in bytes from HeapStart, which may be beyond 4GB; only the
+   values found in the slots of objects and stacks are HeapPointers,
+   decoded with REAL_HEAP_POINTER, which may scale them.  A HeapOffset
+   of -1 is used for none. */
+typedef long HeapOffset;
+#define HEAP_ADDRESS(offset)  ((void*)(HeapStart + (offset)))
+#define HEAP_OFFSET(p)        ((HeapOffset)((uint8_t*)(p) - HeapStart))
+
 /* we will never allocate a block smaller than this */
-#define MINBLOCKSIZE 12
+#define MINBLOCKSIZE 16
 
 /* or larger than this! */
 #define MAXBLOCKSIZE (((uint32_t)(~0x80000000)) - 4)
@@ -46,30 +88,371 @@
 /* this pattern will appear in blocks in the freelist  */
 #define FREELISTBITPATTERN 0x0BADA550
 
-/* this is the 32 bit bitmask for the mark bit */
-#define MARKBIT 0x80000000
+/* a mark deque holds this many objects before it overflows; it must be
+   a power of two */
+#define MARKSTACKSIZE 4096
+
+/* Free blocks are kept in segregated lists: one list for each block size
+   from MINBLOCKSIZE up to LARGESTSIZECLASS, then one list for each power
+   of two, holding the blocks of sizes from that power up to the next. */
+#define LARGESTSIZECLASS 256
+#define NUMSIZECLASSES ((LARGESTSIZECLASS-MINBLOCKSIZE)/HEAPALIGN + 1)
+#define NUMFREELISTS (NUMSIZECLASSES + 23)
+
+/* The collector decides which objects to move a page at a time.  A page
+   is also the unit of card marking. */
+#define HEAPPAGESIZE CARDSIZE
+#define PAGE_PINNED   0x01  /* holds an object which must not be moved */
+#define PAGE_EVACUATE 0x02  /* its live objects are to be moved */
+#define PAGE_NURSERY  0x04  /* part of the nursery */
+
+/* the nursery takes this fraction of the heap */
+#define NURSERYFRACTION 8
+
+/* objects larger than this are never moved */
+#define LARGEOBJECTSIZE (HEAPPAGESIZE/2)
+
+/* objects larger than this are allocated in the large object space */
+#define LOSTHRESHOLD 16384
+
+/* MyHeapAlloc bumps a pointer through a free block at least this big */
+#define BUMPBLOCKSIZE HEAPPAGESIZE
+
+/* only pages at most this percentage full are evacuated */
+#define EVACUATIONLIMIT 50
+
+/* gc() leaves the heap to be swept this many bytes at a time */
+#define SWEEPCHUNKSIZE (32*HEAPPAGESIZE)
+
+/* sweep() divides the heap into parts of this size for the gc threads */
+#define SWEEPPARTSIZE (128*HEAPPAGESIZE)
+
+/* the maximum heap size, unless -Xmx says otherwise */
+#define DEFAULTMAXHEAP (64*1024*1024)
+
+/* after a full gc, the heap is grown if less than MINHEAPFREE percent of
+   it is free, or shrunk if more than MAXHEAPFREE percent is */
+#define MINHEAPFREE 40
+#define MAXHEAPFREE 70
+
+/* the heap is grown as well if more than this percentage of the time
+   since the last full gc was spent collecting */
+#define GCTIMELIMIT 10
+
+/* once the heap has been swept, the OS pages inside free blocks of at
+   least UNCOMMITMINSIZE bytes are returned to the OS, except that
+   UNCOMMITSLACK percent of the heap is left committed for allocation */
+#define UNCOMMITMINSIZE (16*1024)
+#define UNCOMMITSLACK 25
+
+/* with -Xmark:concurrent, marking starts in the background once the old
+   space has taken this percentage of the space left free by the last gc */
+#define CONCURRENTSTART 50
 
+/* the references recorded by SATB_BARRIER are passed to the marking
+   thread in buffers of this many */
+#define SATBBUFFERSIZE 256
 
+/* the kind code of an object which has been moved */
+#define CODE_FWRD (0x46575244)   /* the 4 characters 'FWRD' */
+
+
+/* A block in a free list.  The bit pattern is where an object would have
+   its kind code, so a free block can never be mistaken for an object. */
 typedef struct FreeStorageBlock {
     uint32_t size;  /* size in bytes of this block of storage */
-    int32_t  offsetToNextBlock;
-    uint8_t  restOfBlock[1];   /* the actual size has to be determined from the size field */
+    uint32_t pattern;  /* holds FREELISTBITPATTERN */
+    HeapOffset offsetToNextBlock;  /* next block in the same list, or -1 */
 } FreeStorageBlock;
 
-/* these three variables are externally visible */
+/* The free blocks found by sweeping one part of the heap.  Free list i
+   is linked as in freeLists, from first[i] to last[i]. */
+typedef struct SweptLists {
+    HeapOffset first[NUMFREELISTS], last[NUMFREELISTS];
+    long bytesRecovered;
+    int blocksRecovered;
+} SweptLists;
+
+/* The header of an object in the large object space.  Each large object
+   has whole OS pages to itself, mapped when it is allocated and unmapped
+   when it is found to be dead; the header is at the start of the first
+   page, followed by the size field and the object, as in the heap. */
+typedef struct LargeObject {
+    uint32_t numPages;  /* OS pages that the object occupies */
+    uint32_t marked;    /* set by mark() in a full collection */
+} LargeObject;
+
+#define LOSOBJECTOFFSET (sizeof(LargeObject) + 4)  /* the object, in its page */
+#define LOS_FREE  0     /* the states of the pages of the large object space */
+#define LOS_FIRST 1     /* the first page of an object */
+#define LOS_REST  2     /* a later page of an object */
+
+/* these variables are externally visible */
 uint8_t *HeapStart, *HeapEnd;
-HeapPointer MaxHeapPtr;
+long MaxHeapPtr;
+uint8_t *LosStart, *LosEnd;
+uint8_t *MetaspaceStart, *MetaspaceTop;
 
-static int offsetToFirstBlock = -1;
+static HeapOffset freeLists[NUMFREELISTS];  /* first block, or -1 */
+static uint64_t nonEmptyLists = 0;   /* bit i set if freeLists[i] >= 0 */
 static long totalBytesRequested = 0;
 static int numAllocations = 0;
 static int gcCount = 0;
 static long totalBytesRecovered = 0;
 static int totalBlocksRecovered = 0;
 static int searchCount = 0;
+static long objectsEvacuated = 0;
+static long bytesEvacuated = 0;
+static long totalPagesPinned = 0;
+static int minorGcCount = 0;
+static long objectsPromoted = 0;
+static long bytesPromoted = 0;
+static int concurrentMarkCount = 0;
+static long oldBytesAllocated = 0;     /* since the last gc */
+static long freeAfterGc;               /* bytes not live after the last gc */
+static int largeObjectsAllocated = 0;
+static int largeObjectsFreed = 0;
+static long bytesUncommitted = 0;
+static uint8_t *metaspaceCommitted;    /* the end of its mapped pages */
+
+static int numHeapPages, maxHeapPages;
+static uint8_t *pageFlags;      /* PAGE_PINNED, PAGE_EVACUATE for each page */
+static uint32_t *pageLive;      /* bytes of marked objects starting in each page */
+uint8_t *CardTable;             /* 1 for each page holding a modified object */
+uint8_t *LosCardTable;          /* likewise for the large object space */
+
+static long osPageSize;
+static long numLosPages;
+static long losPagesUsed = 0;   /* no large object is beyond this page */
+static uint8_t *losPageState;   /* LOS_FREE, LOS_FIRST or LOS_REST for each */
+
+/* The nursery is a set of runs of whole pages where small objects are
+   allocated by bumping a pointer through one run after another.  Run i
+   is from nurseryRuns[2*i] up to nurseryRuns[2*i+1]. */
+static HeapOffset *nurseryRuns, *oldNurseryRuns;
+static int numNurseryRuns = 0, nextNurseryRun = 0, numNurseryPages = 0;
+static uint8_t *youngPtr = NULL, *youngLimit = NULL;
+static int collectingNursery = 0;  /* set during a minor collection */
+
+/* An object is marked by setting the bit for its size field in the mark
+   bitmap, which has a bit for every 4 bytes of the heap */
+static uint8_t *markBits;
+
+#define MARKINDEX(sizePtr)  (((uint8_t*)(sizePtr) - HeapStart) / 4)
+
+static int isMarked( uint32_t *sizePtr ) {
+    long ix = MARKINDEX(sizePtr);
+    return (markBits[ix >> 3] >> (ix & 7)) & 1;
+}
+
+/* Sets the mark bit of an object, returning 1 if this thread set it and
+   0 if it was set already, perhaps by another gc thread */
+static int testAndSetMark( uint32_t *sizePtr ) {
+    long ix = MARKINDEX(sizePtr);
+    uint8_t bit = 1 << (ix & 7);
+
+    if (markBits[ix >> 3] & bit)
+        return 0;
+    return !(__atomic_fetch_or(&markBits[ix >> 3], bit, __ATOMIC_RELAXED) & bit);
+}
+
+static void clearMark( uint32_t *sizePtr ) {
+    long ix = MARKINDEX(sizePtr);
+    markBits[ix >> 3] &= ~(1 << (ix & 7));
+}
+
+/* The object-start bitmap has a bit for every HEAPALIGN bytes of the
+   heap, which is set where the size field of an object is.  MyHeapAlloc
+   and moveObject set the bits, and they are cleared as the space becomes
+   free, so a conservative reference is checked with a single bit test.
+   The bits of the bytes which a free run covers entirely are cleared
+   with memset; the others atomically, as a gc thread or the Java
+   program may be using the objects which share the byte. */
+static uint8_t *startBits;
+
+#define STARTINDEX(sizePtr)  (((uint8_t*)(sizePtr) - HeapStart) / HEAPALIGN)
+
+static int isObjectStart( uint32_t *sizePtr ) {
+    long ix = STARTINDEX(sizePtr);
+    return (startBits[ix >> 3] >> (ix & 7)) & 1;
+}
+
+static void setObjectStart( uint32_t *sizePtr ) {
+    long ix = STARTINDEX(sizePtr);
+    __atomic_fetch_or(&startBits[ix >> 3], 1 << (ix & 7), __ATOMIC_RELAXED);
+}
+
+/* Clears the object-start bits of the space from start up to end */
+static void clearObjectStarts( HeapOffset start, HeapOffset end ) {
+    long ix = start / HEAPALIGN, last = end / HEAPALIGN;
+
+    for( ;  (ix & 7) != 0 && ix < last;  ix++ )
+        __atomic_fetch_and(&startBits[ix >> 3], ~(1 << (ix & 7)), __ATOMIC_RELAXED);
+    if (last - ix >= 8) {
+        memset(&startBits[ix >> 3], 0, (last - ix) >> 3);
+        ix += (last - ix) & ~7;
+    }
+    for( ;  ix < last;  ix++ )
+        __atomic_fetch_and(&startBits[ix >> 3], ~(1 << (ix & 7)), __ATOMIC_RELAXED);
+}
+
+/* Returns the object in the heap which address p is within, or NULL if
+   p is in free space.  No object in the heap is bigger than LOSTHRESHOLD
+   bytes, so the search back for its start bit stops there. */
+static uint32_t *objectContaining( uint8_t *p ) {
+    long ix = STARTINDEX(p), low = ix - LOSTHRESHOLD/HEAPALIGN;
+    uint32_t *sizePtr;
+
+    if (low < 0)
+        low = 0;
+    for( ;  ix >= low;  ix-- ) {
+        if (startBits[ix >> 3] == 0)
+            ix &= ~7;
+        else if ((startBits[ix >> 3] >> (ix & 7)) & 1)
+            break;
+    }
+    if (ix < low)
+        return NULL;
+    sizePtr = (uint32_t*)(HeapStart + ix*HEAPALIGN);
+    return p < (uint8_t*)sizePtr + *sizePtr ? sizePtr + 1 : NULL;
+}
+
+/* The marked objects still to be scanned are kept in a deque for each
+   gc thread.  A thread pushes and pops objects at the bottom of its own
+   deque, and when that is empty steals them from the top of another. */
+typedef struct MarkDeque {
+    uint32_t **slots;       /* used circularly */
+    long top, bottom;       /* the objects are slots[top] to slots[bottom-1] */
+} MarkDeque;
+
+static MarkDeque *markDeques;
+static int markStackOverflowed = 0;  /* an object was marked but not pushed */
+static int markersBusy;              /* gc threads which are not out of work */
+
+/* Pushes block on deque d, which must belong to this thread, returning
+   0 if it is full */
+static int pushMark( MarkDeque *d, uint32_t *block ) {
+    long b = d->bottom;
+
+    if (b - __atomic_load_n(&d->top, __ATOMIC_ACQUIRE) >= MARKSTACKSIZE)
+        return 0;
+    __atomic_store_n(&d->slots[b & (MARKSTACKSIZE-1)], block, __ATOMIC_RELAXED);
+    __atomic_store_n(&d->bottom, b + 1, __ATOMIC_RELEASE);
+    return 1;
+}
+
+/* Pops an object from deque d, which must belong to this thread, or
+   returns NULL if it is empty */
+static uint32_t *popMark( MarkDeque *d ) {
+    long b = d->bottom - 1, t;
+    uint32_t *block;
+
+    __atomic_store_n(&d->bottom, b, __ATOMIC_SEQ_CST);
+    t = __atomic_load_n(&d->top, __ATOMIC_SEQ_CST);
+    if (t > b) {
+        __atomic_store_n(&d->bottom, b + 1, __ATOMIC_RELAXED);
+        return NULL;
+    }
+    block = __atomic_load_n(&d->slots[b & (MARKSTACKSIZE-1)], __ATOMIC_RELAXED);
+    if (t == b) {
+        /* the last object, which another thread may be stealing */
+        if (!__atomic_compare_exchange_n(&d->top, &t, t + 1, 0,
+                __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+            block = NULL;
+        __atomic_store_n(&d->bottom, b + 1, __ATOMIC_RELAXED);
+    }
+    return block;
+}
+
+/* Takes an object from the top of another thread's deque d, or returns
+   NULL if it is empty or another thread took the object first */
+static uint32_t *stealMark( MarkDeque *d ) {
+    long t = __atomic_load_n(&d->top, __ATOMIC_SEQ_CST);
+    long b = __atomic_load_n(&d->bottom, __ATOMIC_SEQ_CST);
+    uint32_t *block;
+
+    if (t >= b)
+        return NULL;
+    block = __atomic_load_n(&d->slots[t & (MARKSTACKSIZE-1)], __ATOMIC_RELAXED);
+    if (!__atomic_compare_exchange_n(&d->top, &t, t + 1, 0,
+            __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+        return NULL;
+    return block;
+}
+
+/* The gc threads, which mark and sweep in parallel.  Thread 0 is the one
+   running the collector; the others wait in gcThreadLoop() until it
+   sets gcTask, which each of them then runs with its own number. */
+int ParallelGCThreads = 1;
+static int numGcThreads = 1, gcThreadsStarted = 0;
+static __thread int gcThreadNum = 0;
+static void (*gcTask)( int worker );
+static int gcTaskNumber = 0, gcThreadsBusy = 0;
+static pthread_mutex_t gcTaskLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t gcTaskReady = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t gcTaskDone = PTHREAD_COND_INITIALIZER;
+
+static void *gcThreadLoop( void *arg ) {
+    int seen = 0;
+
+    gcThreadNum = (int)(intptr_t)arg;
+    pthread_mutex_lock(&gcTaskLock);
+    for( ; ; ) {
+        while(gcTaskNumber == seen)
+            pthread_cond_wait(&gcTaskReady, &gcTaskLock);
+        seen = gcTaskNumber;
+        pthread_mutex_unlock(&gcTaskLock);
+        gcTask(gcThreadNum);
+        pthread_mutex_lock(&gcTaskLock);
+        if (--gcThreadsBusy == 0)
+            pthread_cond_signal(&gcTaskDone);
+    }
+    return NULL;
+}
+
+/* Creates the gc threads other than thread 0, the first time a
+   collection needs them; with fewer if they cannot all be created */
+static void startGcThreads() {
+    pthread_t tid;
+    int i;
+
+    if (gcThreadsStarted)
+        return;
+    gcThreadsStarted = 1;
+    for( i = 1;  i < numGcThreads;  i++ ) {
+        if (pthread_create(&tid, NULL, gcThreadLoop, (void*)(intptr_t)i) != 0)
+            break;
+        pthread_detach(tid);
+    }
+    numGcThreads = i;
+}
+
+/* Runs task on all the gc threads at once, returning when every one of
+   them has finished */
+static void runOnGcThreads( void (*task)(int worker) ) {
+    startGcThreads();
+    if (numGcThreads == 1) {
+        task(0);
+        return;
+    }
+    pthread_mutex_lock(&gcTaskLock);
+    gcTask = task;
+    gcThreadsBusy = numGcThreads - 1;
+    gcTaskNumber++;
+    pthread_cond_broadcast(&gcTaskReady);
+    pthread_mutex_unlock(&gcTaskLock);
+    task(0);
+    pthread_mutex_lock(&gcTaskLock);
+    while(gcThreadsBusy > 0)
+        pthread_cond_wait(&gcTaskDone, &gcTaskLock);
+    pthread_mutex_unlock(&gcTaskLock);
+}
+static void *cStackBase = NULL; /* highest address of the C stack */
 
 static void *maxAddr = NULL;    // used by SafeMalloc, etc
 static void *minAddr = NULL;
+// SafeMalloc may be called by the class prefetch threads too
+static pthread_mutex_t addrLock = PTHREAD_MUTEX_INITIALIZER;
 
 
 
@@ -116,28 +499,25 @@ static void printBlock(void *p) {
         printf("    ");
         printByte(*bytePtr++);
     }
-    printf("\tSize (=%d)\n", ~MARKBIT & *(uint32_t *)p);
+    printf("\tSize (=%d)\n", *(uint32_t *)p);
     
     for(i = 0; i < 4; i++) {
         printf("    ");
         printByte(*bytePtr++);
     }
 
-    if(*(uint32_t *)(p + 8) == FREELISTBITPATTERN) {
-        printf("\tRef. to next free block");
-        switch(*(uint32_t *)(bytePtr - 4)) {
-            case 0xFFFFFFFF:
-                printf(" (=NONE)\n");
-                break;
-            default:
-                printf(" (=%p)\n", REAL_HEAP_POINTER(*(uint32_t *)(p + 4)));
-        };
+    if(*(uint32_t *)(p + 4) == FREELISTBITPATTERN) {
+        printf("\t\"Free List\" Bit Pattern (=%X)\n", FREELISTBITPATTERN);
         
         for(i = 0; i < 4; i++) {
             printf("    ");
             printByte(*bytePtr++);
         }
-        printf("\t\"Free List\" Bit Pattern (=%X)\n", FREELISTBITPATTERN);
+        printf("\tRef. to next free block");
+        if (((FreeStorageBlock*)p)->offsetToNextBlock < 0)
+            printf(" (=NONE)\n");
+        else
+            printf(" (=%p)\n", HEAP_ADDRESS(((FreeStorageBlock*)p)->offsetToNextBlock));
         
     }
     else {
@@ -200,10 +580,10 @@ static void printHeap() {
     printf("Heap -- Start: %p\n", HeapStart);
     printf("------------------------\n");
     
-    HeapPointer Heap_Iterator = 0;
+    HeapOffset Heap_Iterator = 0;
     while(Heap_Iterator < MaxHeapPtr) {
-        printBlock(REAL_HEAP_POINTER(Heap_Iterator));
-        Heap_Iterator += ~MARKBIT & *(uint32_t *)REAL_HEAP_POINTER(Heap_Iterator);
+        printBlock(HEAP_ADDRESS(Heap_Iterator));
+        Heap_Iterator += *(uint32_t *)HEAP_ADDRESS(Heap_Iterator);
     }
 
     printf("----------------------\n");
@@ -212,29 +592,759 @@ static void printHeap() {
 }
 
 
-/* Allocate the Java heap and initialize the free list */
+/* Returns the number of the free list which holds blocks of size bytes */
+static int freeListIndex( uint32_t size ) {
+    if (size <= LARGESTSIZECLASS)
+        return (size - MINBLOCKSIZE) / HEAPALIGN;
+    /* a larger block goes in the bin for its power of two */
+    return NUMSIZECLASSES + (31 - __builtin_clz(size)) - 8;
+}
+
+
+/* Puts the free block at offset into the list for its size */
+static void addToFreeList( HeapOffset offset ) {
+    FreeStorageBlock *blockPtr = (FreeStorageBlock*)HEAP_ADDRESS(offset);
+    int ix = freeListIndex(blockPtr->size);
+
+    blockPtr->pattern = FREELISTBITPATTERN;
+    blockPtr->offsetToNextBlock = freeLists[ix];
+    freeLists[ix] = offset;
+    nonEmptyLists |= (uint64_t)1 << ix;
+}
+
+
+/* Takes the first block off free list ix, which must not be empty */
+static FreeStorageBlock *takeFromFreeList( int ix ) {
+    FreeStorageBlock *blockPtr =
+        (FreeStorageBlock*)HEAP_ADDRESS(freeLists[ix]);
+
+    freeLists[ix] = blockPtr->offsetToNextBlock;
+    if (freeLists[ix] < 0)
+        nonEmptyLists &= ~((uint64_t)1 << ix);
+    return blockPtr;
+}
+
+
+static void clearFreeLists() {
+    int i;
+    for( i = 0;  i < NUMFREELISTS;  i++ )
+        freeLists[i] = -1;
+    nonEmptyLists = 0;
+}
+
+
+/* Removes a block of at least minSize bytes from the free lists and
+   returns it, or returns NULL if there is none.
+   A block from the list for minSize's exact size is taken if there is
+   one; otherwise the first block of the next non-empty list, which must
+   be big enough.  Blocks larger than LARGESTSIZECLASS are kept in one
+   list per power of two, and only the list for minSize is searched. */
+static FreeStorageBlock *findFreeBlock( int minSize ) {
+    FreeStorageBlock *blockPtr, *prevBlockPtr = NULL;
+    uint64_t candidates;
+    HeapOffset offset;
+    int ix = freeListIndex(minSize);
+
+    if (ix >= NUMSIZECLASSES) {
+        /* first fit within the bin for this size */
+        for( offset = freeLists[ix];  offset >= 0;  offset = blockPtr->offsetToNextBlock ) {
+            searchCount++;
+            blockPtr = (FreeStorageBlock*)(HeapStart + offset);
+            if (blockPtr->size >= minSize) {
+                if (prevBlockPtr == NULL)
+                    freeLists[ix] = blockPtr->offsetToNextBlock;
+                else
+                    prevBlockPtr->offsetToNextBlock = blockPtr->offsetToNextBlock;
+                if (freeLists[ix] < 0)
+                    nonEmptyLists &= ~((uint64_t)1 << ix);
+                return blockPtr;
+            }
+            prevBlockPtr = blockPtr;
+        }
+        ix++;
+    }
+    /* any block in a later non-empty list is big enough */
+    candidates = nonEmptyLists & ~(((uint64_t)1 << ix) - 1);
+    if (candidates == 0)
+        return NULL;
+    searchCount++;
+    return takeFromFreeList(__builtin_ctzll(candidates));
+}
+
+
+/* Takes size bytes from the start of the free block at blockPtr, which
+   must not be in a free list, and formats the rest as a free block.
+   The size is increased if the rest would be too small to be a block.
+   The result is the size of the rest, which may be 0. */
+static int splitFreeBlock( FreeStorageBlock *blockPtr, int size ) {
+    int diff = blockPtr->size - size;
+    FreeStorageBlock *newBlockPtr;
+
+    if (diff < MINBLOCKSIZE)
+        return 0;  /* the whole block is used */
+    blockPtr->size = size;
+    newBlockPtr = (FreeStorageBlock*)((uint8_t*)blockPtr + size);
+    newBlockPtr->size = diff;
+    newBlockPtr->pattern = FREELISTBITPATTERN;
+    return diff;
+}
+
+
+/* The block that MyHeapAlloc allocates from by bumping a pointer.  The
+   part not yet allocated is always formatted as a free block, which is
+   not in any free list, so the heap can be walked at any time. */
+static uint8_t *bumpPtr = NULL, *bumpLimit = NULL;
+
+/* Lazy sweeping.  Unless pages are being evacuated, gc() leaves the heap
+   from sweepPtr up to sweepEnd unswept, and MyHeapAlloc sweeps it a
+   chunk at a time when it runs out of space, taking nurseryWanted pages
+   for the nursery as it goes.  With SWEEP_BACKGROUND, a thread started
+   by gc() sweeps the chunks too, and then sweepLock must be held while
+   the free lists or the nursery runs are used. */
+int SweepMode = SWEEP_LAZY;
+static HeapOffset sweepPtr = 0, sweepEnd = 0;
+static int nurseryWanted = 0;
+static SweptLists *sweptLists;          /* for each part swept by sweep() */
+static HeapOffset *sweepPartStart;      /* where sweeping each part begins */
+static int numSweepParts, nextSweepPart;
+static pthread_t sweeperThread;
+static int sweeperActive = 0;
+static pthread_mutex_t sweepLock = PTHREAD_MUTEX_INITIALIZER;
+
+static void lockHeap() {
+    if (sweeperActive)
+        pthread_mutex_lock(&sweepLock);
+}
+
+static void unlockHeap() {
+    if (sweeperActive)
+        pthread_mutex_unlock(&sweepLock);
+}
+
+static int sweepChunk();
+static void startSweep();
+static void finishSweep();
+
+/* Concurrent marking.  With -Xmark:concurrent, a minor collection which
+   leaves the old space fuller than CONCURRENTSTART starts a marking
+   thread, which traces the heap from deque 0 while the Java program
+   runs.  The nursery is given up for the duration, and the objects
+   allocated meanwhile are marked as they are allocated.  Overwritten
+   references are recorded by SATB_BARRIER in satbCurrent; full buffers
+   are passed to the marking thread on satbFull.  Once it runs out of
+   work, the next allocation calls gc(), which stops the thread and
+   remarks from the stacks and the recorded references. */
+typedef struct SatbBuffer {
+    struct SatbBuffer *next;
+    int count;
+    HeapPointer refs[SATBBUFFERSIZE];
+} SatbBuffer;
+
+int ConcurrentMark = 0;
+int ConcurrentMarking = 0;
+static SatbBuffer *satbCurrent = NULL, *satbFull = NULL, *satbSpare = NULL;
+static pthread_mutex_t satbLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t satbReady = PTHREAD_COND_INITIALIZER;
+static pthread_t markerThread;
+static int markerActive = 0, stopMarking = 0, markingDone = 0;
+
+static void startConcurrentMark();
+static void finishConcurrentMark();
+
+/* Puts what is left of the allocation block back into the free lists */
+static void retireBumpBlock() {
+    if (bumpPtr != NULL && bumpLimit - bumpPtr >= MINBLOCKSIZE)
+        addToFreeList(bumpPtr - HeapStart);
+    bumpPtr = bumpLimit = NULL;
+}
+
+
+/* Heap sizing.  The address space for MaxHeapSize bytes of heap is
+   reserved at the start, but only the first MaxHeapPtr bytes are in
+   use; only they, and the rest of their last OS page, are mapped.  After
+   each full gc, sizeHeap() grows the heap in place if it is short of
+   free space or the program has been spending too long collecting, or
+   shrinks it if it is mostly free, though never below initialHeapSize.
+   MyHeapAlloc grows it too if a gc does not free enough. */
+long MaxHeapSize = 0;
+static long initialHeapSize;
+static uint8_t *committedEnd;       /* end of the mapped part of the heap */
+static long gcNanos = 0;            /* spent collecting since lastSizing */
+static long gcStartTime, lastSizing;
+static int heapResizes = 0;
+
+static long nanoTime() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+
+/* Sets the size of the heap, and of the tables which describe it */
+static void setHeapSize( long size ) {
+    HeapEnd = HeapStart + size;
+    MaxHeapPtr = size;
+    numHeapPages = (MaxHeapPtr + HEAPPAGESIZE - 1) / HEAPPAGESIZE;
+    numSweepParts = (MaxHeapPtr + SWEEPPARTSIZE - 1) / SWEEPPARTSIZE;
+}
+
+
+/* Allocates the tables for a heap of up to MaxHeapSize bytes */
+static void allocatePageTables() {
+    int i, maxSweepParts = (MaxHeapSize + SWEEPPARTSIZE - 1) / SWEEPPARTSIZE;
+
+    maxHeapPages = (MaxHeapSize + HEAPPAGESIZE - 1) / HEAPPAGESIZE;
+    pageFlags = SafeCalloc(maxHeapPages, sizeof(uint8_t));
+    pageLive = SafeCalloc(maxHeapPages, sizeof(uint32_t));
+    CardTable = SafeCalloc(maxHeapPages, sizeof(uint8_t));
+    LosCardTable = SafeCalloc(numLosPages*osPageSize/LOSCARDSIZE, sizeof(uint8_t));
+    losPageState = SafeCalloc(numLosPages, sizeof(uint8_t));
+    nurseryRuns = SafeCalloc(2*maxHeapPages, sizeof(HeapOffset));
+    oldNurseryRuns = SafeCalloc(2*maxHeapPages, sizeof(HeapOffset));
+    markBits = SafeCalloc(MaxHeapSize/32 + 1, sizeof(uint8_t));
+    startBits = SafeCalloc(MaxHeapSize/(8*HEAPALIGN) + 1, sizeof(uint8_t));
+    freeAfterGc = MaxHeapPtr;
+    sweptLists = SafeCalloc(maxSweepParts, sizeof(SweptLists));
+    sweepPartStart = SafeCalloc(maxSweepParts + 1, sizeof(HeapOffset));
+    if (ParallelGCThreads > 1)
+        numGcThreads = ParallelGCThreads;
+    markDeques = SafeCalloc(numGcThreads, sizeof(MarkDeque));
+    for( i = 0;  i < numGcThreads;  i++ )
+        markDeques[i].slots = SafeCalloc(MARKSTACKSIZE, sizeof(uint32_t*));
+}
+
+
+/* Makes the space from start up to end a free block in the free lists */
+static void freeRange( HeapOffset start, HeapOffset end ) {
+    FreeStorageBlock *blockPtr = (FreeStorageBlock*)HEAP_ADDRESS(start);
+    clearObjectStarts(start, end);
+    blockPtr->size = end - start;
+    addToFreeList(start);
+}
+
+
+/* Frees the space from start up to end.  The whole pages within it
+   become a nursery run, if *wanted is more than 0, and the rest goes
+   into the free lists.  *wanted is reduced by the number of pages used.
+   Either nothing or a usable free block is left on each side of a run. */
+static void carveRange( HeapOffset start, HeapOffset end, int *wanted ) {
+    HeapOffset pageStart, pageEnd, p;
+    FreeStorageBlock *blockPtr;
+
+    pageStart = (start + HEAPPAGESIZE - 1) & ~(HEAPPAGESIZE - 1);
+    if (pageStart > start && pageStart - start < MINBLOCKSIZE)
+        pageStart += HEAPPAGESIZE;
+    pageEnd = end & ~(HEAPPAGESIZE - 1);
+    if (pageEnd < end && end - pageEnd < MINBLOCKSIZE)
+        pageEnd -= HEAPPAGESIZE;
+    if (*wanted <= 0)
+        pageEnd = pageStart;
+    else if (pageEnd > pageStart + (long)*wanted * HEAPPAGESIZE)
+        pageEnd = pageStart + (long)*wanted * HEAPPAGESIZE;
+    if (pageEnd <= pageStart) {
+        freeRange(start, end);
+        return;
+    }
+    if (pageStart > start)
+        freeRange(start, pageStart);
+    clearObjectStarts(pageStart, pageEnd);
+    blockPtr = (FreeStorageBlock*)HEAP_ADDRESS(pageStart);
+    blockPtr->size = pageEnd - pageStart;
+    blockPtr->pattern = FREELISTBITPATTERN;
+    for( p = pageStart;  p < pageEnd;  p += HEAPPAGESIZE )
+        pageFlags[p/HEAPPAGESIZE] |= PAGE_NURSERY;
+    nurseryRuns[2*numNurseryRuns] = pageStart;
+    nurseryRuns[2*numNurseryRuns+1] = pageEnd;
+    numNurseryRuns++;
+    numNurseryPages += (pageEnd - pageStart) / HEAPPAGESIZE;
+    *wanted -= (pageEnd - pageStart) / HEAPPAGESIZE;
+    if (pageEnd < end)
+        freeRange(pageEnd, end);
+}
+
+
+/* Rebuilds the free lists from the free blocks in the heap, taking
+   wholly free pages from them for the nursery until the nursery holds
+   1/NURSERYFRACTION of the heap, or a quarter of the free space if that
+   is less.  The allocation block is given up. */
+static void carveNursery() {
+    int wanted = numHeapPages / NURSERYFRACTION;
+    long freeSpace = 0;
+    HeapOffset hp, next;
+
+    retireBumpBlock();
+    for( hp = 0;  hp < MaxHeapPtr;  hp += *(uint32_t *)HEAP_ADDRESS(hp) ) {
+        FreeStorageBlock *blockPtr = (FreeStorageBlock*)HEAP_ADDRESS(hp);
+        if (blockPtr->pattern == FREELISTBITPATTERN)
+            freeSpace += blockPtr->size;
+    }
+    if (wanted > freeSpace / HEAPPAGESIZE / 4)
+        wanted = freeSpace / HEAPPAGESIZE / 4;
+    wanted -= numNurseryPages;
+    clearFreeLists();
+    for( hp = 0;  hp < MaxHeapPtr;  hp = next ) {
+        FreeStorageBlock *blockPtr = (FreeStorageBlock*)HEAP_ADDRESS(hp);
+
+        next = hp + blockPtr->size;
+        if (blockPtr->pattern == FREELISTBITPATTERN
+                && !(pageFlags[hp/HEAPPAGESIZE] & PAGE_NURSERY))
+            carveRange(hp, next, &wanted);
+    }
+}
+
+
+/* Makes the whole nursery part of the old space, as for a full gc */
+static void retireNursery() {
+    HeapOffset p;
+    int i;
+
+    for( i = 0;  i < numNurseryRuns;  i++ )
+        for( p = nurseryRuns[2*i];  p < nurseryRuns[2*i+1];  p += HEAPPAGESIZE )
+            pageFlags[p/HEAPPAGESIZE] &= ~PAGE_NURSERY;
+    numNurseryRuns = nextNurseryRun = numNurseryPages = 0;
+    youngPtr = youngLimit = NULL;
+}
+
+
+/* Returns the large object after lo, or the first one if lo is NULL, or
+   NULL if there are no more */
+static LargeObject *nextLargeObject( LargeObject *lo ) {
+    long i = 0;
+
+    if (lo != NULL)
+        i = ((uint8_t*)lo - LosStart) / osPageSize + lo->numPages;
+    for( ;  i < losPagesUsed;  i++ )
+        if (losPageState[i] == LOS_FIRST)
+            return (LargeObject*)(LosStart + i*osPageSize);
+    return NULL;
+}
+
+
+/* Returns the large object which address p is within, or NULL if p is
+   not within one */
+static uint32_t *largeObjectAt( uint8_t *p ) {
+    long i;
+
+    if (p < LosStart || p >= LosEnd)
+        return NULL;
+    i = (p - LosStart) / osPageSize;
+    while(i > 0 && losPageState[i] == LOS_REST)
+        i--;
+    if (losPageState[i] != LOS_FIRST)
+        return NULL;
+    return (uint32_t*)(LosStart + i*osPageSize + LOSOBJECTOFFSET);
+}
+
+
+/* Maps numPages pages of the large object space, from page i, for a
+   large object of size bytes, and returns its header */
+static LargeObject *mapLargeObject( long i, long numPages, uint32_t size ) {
+    LargeObject *lo = (LargeObject*)(LosStart + i*osPageSize);
+
+    if (mmap(lo, numPages*osPageSize, PROT_READ|PROT_WRITE,
+            MAP_PRIVATE|MAP_ANONYMOUS|MAP_FIXED, -1, 0) == MAP_FAILED)
+        return NULL;
+    losPageState[i] = LOS_FIRST;
+    memset(&losPageState[i+1], LOS_REST, numPages-1);
+    if (losPagesUsed < i + numPages)
+        losPagesUsed = i + numPages;
+    lo->numPages = numPages;
+    *(uint32_t*)(lo + 1) = size;
+    largeObjectsAllocated++;
+    return lo;
+}
+
+
+/* Returns a block of size bytes in the large object space, or NULL if
+   there is no room for it.  The first run of free pages which is long
+   enough is used; the pages are freshly mapped, and so hold zeros. */
+static FreeStorageBlock *allocateLarge( int size ) {
+    long numPages = (sizeof(LargeObject) + size + osPageSize - 1) / osPageSize;
+    long i, run = 0;
+    LargeObject *lo;
+
+    for( i = 0;  i < numLosPages && run < numPages;  i++ )
+        run = (losPageState[i] == LOS_FREE)? run + 1 : 0;
+    if (run < numPages)
+        return NULL;
+    lo = mapLargeObject(i - numPages, numPages, size);
+    if (lo == NULL)
+        return NULL;
+    /* one allocated while marking is in progress is live */
+    lo->marked = ConcurrentMarking;
+    if (tracingExecution & TRACE_HEAP)
+        printf("* large object of size %d allocated at %p\n", size,
+            (uint8_t*)lo + LOSOBJECTOFFSET);
+    return (FreeStorageBlock*)(lo + 1);
+}
+
+
+/* Unmaps the pages of the large object lo, leaving them reserved */
+static void freeLargeObject( LargeObject *lo ) {
+    long i = ((uint8_t*)lo - LosStart) / osPageSize, numPages = lo->numPages;
+
+    if (tracingExecution & TRACE_HEAP)
+        printf("sweep(): Found garbage at %p\n", (uint8_t*)lo + LOSOBJECTOFFSET);
+    totalBytesRecovered += *(uint32_t*)(lo + 1);
+    totalBlocksRecovered++;
+    largeObjectsFreed++;
+    memset(&losPageState[i], LOS_FREE, numPages);
+    if (mmap(lo, numPages*osPageSize, PROT_NONE,
+            MAP_PRIVATE|MAP_ANONYMOUS|MAP_FIXED|MAP_NORESERVE, -1, 0) == MAP_FAILED) {
+        fprintf(stderr, "unable to release a large object\n");
+        exit(1);
+    }
+}
+
+
+/* Clears the cards of the heap and of the part of the large object
+   space that has been used */
+static void clearCards() {
+    memset(CardTable, 0, numHeapPages);
+    memset(LosCardTable, 0, losPagesUsed*osPageSize/LOSCARDSIZE);
+}
+
+
+/* Records where the C stack of the calling thread, the one which will
+   run the Java program, ends, so that gc can scan it */
+static void findStackBase() {
+    pthread_attr_t attr;
+    void *addr;
+    size_t size;
+
+    if (pthread_getattr_np(pthread_self(), &attr) == 0) {
+        if (pthread_attr_getstack(&attr, &addr, &size) == 0)
+            cStackBase = (uint8_t*)addr + size;
+        pthread_attr_destroy(&attr);
+    }
+    if (cStackBase == NULL)
+        cStackBase = (void*)&attr;  // the caller's frame, at least
+}
+
+
+/* Reserves the address space for a heap which starts with heapSize
+   bytes and may grow to MaxHeapSize bytes, followed by the metaspace
+   and then a large object space of the same size as the heap, so far
+   as references can reach, and returns the start of the heap.  With
+   SCALED_REFERENCES, the large object space has all the rest of the
+   MAXREFERENCEDBYTES that they reach.  None of it is usable until it
+   has been mapped. */
+uint8_t *ReserveHeap( long heapSize ) {
+    size_t heapBytes, metaBytes = METASPACESIZE, losBytes;
+    uint8_t *heap;
+
+    if (MaxHeapSize <= 0)
+        MaxHeapSize = DEFAULTMAXHEAP;
+    if (MaxHeapSize < heapSize)
+        MaxHeapSize = heapSize;
+    if (MaxHeapSize > MAXHEAPSIZE)
+        MaxHeapSize = MAXHEAPSIZE;
+    MaxHeapSize &= ~(HEAPALIGN-1);
+    initialHeapSize = heapSize;
+    osPageSize = sysconf(_SC_PAGESIZE);
+    heapBytes = (MaxHeapSize + osPageSize - 1) / osPageSize * osPageSize;
+    losBytes = heapBytes;
+    if (HEAPREFSHIFT > 0 || losBytes > MAXREFERENCEDBYTES - heapBytes - metaBytes)
+        losBytes = (MAXREFERENCEDBYTES - heapBytes - metaBytes) / osPageSize * osPageSize;
+    heap = mmap(NULL, heapBytes + metaBytes + losBytes, PROT_NONE,
+        MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE, -1, 0);
+    if (heap == MAP_FAILED) {
+        fprintf(stderr, "unable to reserve %ld bytes for heap\n",
+            (long)(heapBytes + metaBytes + losBytes));
+        exit(1);
+    }
+    MetaspaceStart = MetaspaceTop = metaspaceCommitted = heap + heapBytes;
+    LosStart = MetaspaceStart + metaBytes;
+    LosEnd = LosStart + losBytes;
+    numLosPages = losBytes / osPageSize;
+    return heap;
+}
+
+
+/* Allocate the Java heap and initialize the free lists */
 void InitMyAlloc( int HeapSize ) {
     FreeStorageBlock *FreeBlock;
 
-    HeapSize &= 0xfffffffc;   /* force to a multiple of 4 */
-    HeapStart = calloc(1,HeapSize);
-    if (HeapStart == NULL) {
+    HeapSize &= ~(HEAPALIGN-1);   /* force to a multiple of 8 */
+    HeapStart = ReserveHeap(HeapSize);
+    committedEnd = HeapStart + (HeapSize + osPageSize - 1) / osPageSize * osPageSize;
+    if (mprotect(HeapStart, committedEnd - HeapStart, PROT_READ|PROT_WRITE) != 0) {
         fprintf(stderr, "unable to allocate %d bytes for heap\n", HeapSize);
         exit(1);
     }
-    HeapEnd = HeapStart + HeapSize;
-    MaxHeapPtr = (HeapPointer)HeapSize;
-    
+    setHeapSize(HeapSize);
+    lastSizing = nanoTime();
+
     FreeBlock = (FreeStorageBlock*)HeapStart;
     FreeBlock->size = HeapSize;
-    FreeBlock->offsetToNextBlock = -1;  /* marks end of list */
-    *(uint32_t *)FreeBlock->restOfBlock = FREELISTBITPATTERN;
-    offsetToFirstBlock = 0;
-    
+    FreeBlock->pattern = FREELISTBITPATTERN;
+
     // Used bu SafeMalloc, SafeCalloc, SafeFree below
-    maxAddr = minAddr = malloc(4);  // minimal small request to get things started
+    if (minAddr == NULL)
+        maxAddr = minAddr = malloc(4);  // minimal small request to get things started
+    allocatePageTables();
+    carveNursery();
+    findStackBase();
+}
+
+/* Use the copy of a saved heap at heap, which ReserveHeap returned, as
+   the Java heap.  The free lists are rebuilt from the free blocks found
+   in the copy, and all the objects in it are treated as old. */
+void AdoptHeap( uint8_t *heap, long heapSize ) {
+    HeapOffset hp;
+
+    HeapStart = heap;
+    committedEnd = HeapStart + (heapSize + osPageSize - 1) / osPageSize * osPageSize;
+    setHeapSize(heapSize);
+    lastSizing = nanoTime();
+    if (minAddr == NULL)
+        maxAddr = minAddr = malloc(4);
+    allocatePageTables();
+    for( hp = 0;  hp < MaxHeapPtr;  hp += *(uint32_t *)HEAP_ADDRESS(hp) )
+        if (((FreeStorageBlock*)HEAP_ADDRESS(hp))->pattern != FREELISTBITPATTERN)
+            setObjectStart(HEAP_ADDRESS(hp));
+    carveNursery();
+    findStackBase();
+}
+
+
+/* Extends the heap to newSize bytes, mapping more of it as necessary.
+   The new space becomes one free block, which is not in any free list.
+   Returns 0 if the heap cannot be extended by at least MINBLOCKSIZE. */
+static int extendHeap( long newSize ) {
+    long oldSize = MaxHeapPtr, ix;
+    uint8_t *end = HeapStart + (newSize + osPageSize - 1) / osPageSize * osPageSize;
+    int firstPage = (oldSize + HEAPPAGESIZE - 1) / HEAPPAGESIZE;
+    FreeStorageBlock *blockPtr;
+
+    if (newSize > MaxHeapSize || newSize < oldSize + MINBLOCKSIZE)
+        return 0;
+    if (end > committedEnd) {
+        if (mprotect(committedEnd, end - committedEnd, PROT_READ|PROT_WRITE) != 0)
+            return 0;
+        committedEnd = end;
+    }
+    blockPtr = (FreeStorageBlock*)HEAP_ADDRESS(oldSize);
+    blockPtr->size = newSize - oldSize;
+    blockPtr->pattern = FREELISTBITPATTERN;
+    setHeapSize(newSize);
+    /* the tables may still describe the heap as it was before a shrink */
+    memset(&pageFlags[firstPage], 0, numHeapPages - firstPage);
+    memset(&pageLive[firstPage], 0, (numHeapPages - firstPage)*sizeof(uint32_t));
+    memset(&CardTable[firstPage], 0, numHeapPages - firstPage);
+    for( ix = oldSize / 4;  (ix & 7) != 0;  ix++ )
+        clearMark(HEAP_ADDRESS(ix * 4));
+    memset(&markBits[ix >> 3], 0, newSize/32 + 1 - (ix >> 3));
+    heapResizes++;
+    if (tracingExecution & TRACE_HEAP)
+        printf("* heap grown from %ld to %ld bytes\n", oldSize, newSize);
+    return 1;
+}
+
+
+/* Reduces the heap to newSize bytes and unmaps the pages beyond it,
+   which must hold no objects */
+static void shrinkHeap( long newSize ) {
+    uint8_t *end = HeapStart + (newSize + osPageSize - 1) / osPageSize * osPageSize;
+
+    if (end < committedEnd) {
+        if (mmap(end, committedEnd - end, PROT_NONE,
+                MAP_PRIVATE|MAP_ANONYMOUS|MAP_FIXED|MAP_NORESERVE, -1, 0) == MAP_FAILED) {
+            fprintf(stderr, "unable to shrink the heap\n");
+            exit(1);
+        }
+        committedEnd = end;
+    }
+    if (tracingExecution & TRACE_HEAP)
+        printf("* heap shrunk from %ld to %ld bytes\n", MaxHeapPtr, newSize);
+    setHeapSize(newSize);
+    heapResizes++;
+}
+
+
+/* Returns the OS pages inside the larger free blocks to the OS, largest
+   blocks first, until all but UNCOMMITSLACK percent of the space left
+   free by the last gc has been released.  The block headers stay put;
+   the pages are faulted back in, zeroed, when the space is reused.
+   The heap must be locked or stopped. */
+static void uncommitFreePages() {
+    long excess = freeAfterGc - MaxHeapPtr / 100 * UNCOMMITSLACK, released = 0;
+    FreeStorageBlock *blockPtr;
+    uint8_t *start, *end;
+    HeapOffset offset;
+    int ix;
+
+    for( ix = NUMFREELISTS - 1;  ix >= freeListIndex(UNCOMMITMINSIZE) && released < excess;  ix-- ) {
+        for( offset = freeLists[ix];  offset >= 0 && released < excess;
+                offset = blockPtr->offsetToNextBlock ) {
+            blockPtr = (FreeStorageBlock*)HEAP_ADDRESS(offset);
+            if (blockPtr->size < UNCOMMITMINSIZE)
+                continue;
+            start = (uint8_t*)(((uintptr_t)(blockPtr + 1) + osPageSize - 1) & ~(osPageSize - 1));
+            end = (uint8_t*)(((uintptr_t)blockPtr + blockPtr->size) & ~(osPageSize - 1));
+            if (end > start && madvise(start, end - start, MADV_DONTNEED) == 0)
+                released += end - start;
+        }
+    }
+    bytesUncommitted += released;
+    if (released > 0 && (tracingExecution & TRACE_HEAP))
+        printf("* returned %ld bytes of free heap to the OS\n", released);
+}
+
+
+/* Grows the heap outside a gc, by half its size if possible, but by at
+   least enough for a block of minSize bytes, and puts the new space in
+   the free lists.  Returns 0 if the heap cannot grow that much. */
+static int growHeap( int minSize ) {
+    long newSize = MaxHeapPtr + MaxHeapPtr/2;
+    HeapOffset oldSize = MaxHeapPtr;
+    int grown;
+
+    if (newSize < MaxHeapPtr + minSize + MINBLOCKSIZE)
+        newSize = MaxHeapPtr + minSize + MINBLOCKSIZE;
+    newSize = (newSize + HEAPPAGESIZE - 1) & ~(HEAPPAGESIZE - 1);
+    if (newSize > MaxHeapSize)
+        newSize = MaxHeapSize;
+    if (newSize < MaxHeapPtr + minSize)
+        return 0;
+    lockHeap();
+    grown = extendHeap(newSize);
+    if (grown)
+        addToFreeList(oldSize);
+    unlockHeap();
+    return grown;
+}
+
+
+/* Maps the pages for the large object that ref refers to, of size
+   bytes, so that a saved one can be copied there, and returns the
+   address of its size field */
+void *AdoptLargeObject( HeapPointer ref, uint32_t size ) {
+    uint8_t *p = (uint8_t*)REAL_HEAP_POINTER(ref) - LOSOBJECTOFFSET;
+    long numPages = (sizeof(LargeObject) + size + osPageSize - 1) / osPageSize;
+    LargeObject *lo;
+
+    lo = mapLargeObject((p - LosStart) / osPageSize, numPages, size);
+    if (lo == NULL) {
+        fprintf(stderr, "unable to restore a large object\n");
+        exit(1);
+    }
+    return lo + 1;
+}
+
+
+/* Maps the first size bytes of the metaspace, so that a saved copy can
+   be put there, and returns its start; the classes are allocated after
+   them */
+void *AdoptMetaspace( long size ) {
+    uint8_t *end = MetaspaceStart + (size + osPageSize - 1) / osPageSize * osPageSize;
+
+    if (end > LosStart
+            || mprotect(MetaspaceStart, end - MetaspaceStart, PROT_READ|PROT_WRITE) != 0) {
+        fprintf(stderr, "unable to restore the metaspace\n");
+        exit(1);
+    }
+    metaspaceCommitted = end;
+    MetaspaceTop = MetaspaceStart + size;
+    return MetaspaceStart;
+}
+
+
+/* Calls visit for each allocated object in the heap, in address order,
+   and then for each object in the large object space */
+void ForEachHeapObject( void (*visit)(void *obj) ) {
+    LargeObject *lo;
+    HeapOffset hp;
+
+    finishSweep();
+    for( hp = 0;  hp < MaxHeapPtr;  hp += *(uint32_t *)HEAP_ADDRESS(hp) ) {
+        if (((FreeStorageBlock*)HEAP_ADDRESS(hp))->pattern != FREELISTBITPATTERN)
+            visit(HEAP_ADDRESS(hp + 4));
+    }
+    for( lo = nextLargeObject(NULL);  lo != NULL;  lo = nextLargeObject(lo) )
+        visit((uint8_t*)lo + LOSOBJECTOFFSET);
+}
+
+
+/* Returns a block of size bytes from the nursery, or NULL if the
+   nursery is full */
+static FreeStorageBlock *allocateYoung( int size ) {
+    FreeStorageBlock *blockPtr;
+
+    while(youngLimit - youngPtr < size) {
+        /* the rest of the run is left as a free block */
+        lockHeap();
+        if (nextNurseryRun >= numNurseryRuns) {
+            unlockHeap();
+            return NULL;
+        }
+        youngPtr = HEAP_ADDRESS(nurseryRuns[2*nextNurseryRun]);
+        youngLimit = HEAP_ADDRESS(nurseryRuns[2*nextNurseryRun+1]);
+        nextNurseryRun++;
+        unlockHeap();
+    }
+    blockPtr = (FreeStorageBlock*)youngPtr;
+    splitFreeBlock(blockPtr, size);
+    youngPtr += blockPtr->size;
+    return blockPtr;
+}
+
+
+/* Returns a block of at least size bytes from the old space, or NULL
+   if there is none */
+static FreeStorageBlock *allocateOld( int size ) {
+    FreeStorageBlock *blockPtr;
+    int blocksize, rest;
+
+    if (bumpLimit - bumpPtr < size && size <= BUMPBLOCKSIZE) {
+        /* start a new allocation block */
+        blockPtr = findFreeBlock(BUMPBLOCKSIZE);
+        if (blockPtr != NULL) {
+            retireBumpBlock();
+            bumpPtr = (uint8_t*)blockPtr;
+            bumpLimit = bumpPtr + blockPtr->size;
+        }
+    }
+    if (bumpLimit - bumpPtr >= size) {
+        blockPtr = (FreeStorageBlock*)bumpPtr;
+        rest = splitFreeBlock(blockPtr, size);
+        bumpPtr += blockPtr->size;
+        if (rest == 0)
+            bumpPtr = bumpLimit = NULL;
+        return blockPtr;
+    }
+    /* segregated fit from the free lists */
+    blockPtr = findFreeBlock(size);
+    if (blockPtr == NULL)
+        return NULL;
+    blocksize = blockPtr->size;
+    /* the following check should be quite unnecessary, but is
+       a good idea to have while debugging */
+    if (blocksize < size || (blocksize&(HEAPALIGN-1)) != 0
+            || blockPtr->pattern != FREELISTBITPATTERN) {
+        fprintf(stderr,
+            "corrupted block in the free list -- bad size field\n");
+        exit(1);
+    }
+    /* any significant amount of storage left over after taking
+       what we need goes into the free list for its size */
+    rest = splitFreeBlock(blockPtr, size);
+    if (rest > 0)
+        addToFreeList(HEAP_OFFSET(blockPtr) + size);
+    if (tracingExecution & TRACE_HEAP) {
+        if (rest > 0)
+            fprintf(stdout, "* free list block of size %d split into %d + %d\n",
+                blocksize, size, rest);
+        else
+            fprintf(stdout, "* free list block of size %d used\n", blocksize);
+    }
+    return blockPtr;
 }
 
+
+static void minorGc();
+
 /* Returns a pointer to a block with at least size bytes available,
    and initialized to hold zeros.
    Notes:
@@ -244,63 +1354,78 @@ void InitMyAlloc( int HeapSize ) {
       this size field).
    3. A block larger than that requested may be returned if the
       leftover portion would be too small to be useful.
-   4. The size of the returned block is always a multiple of 4.
+   4. The size of the returned block is always a multiple of 8.
    5. The implementation of MyAlloc contains redundant tests to
       verify that the free list blocks contain plausible info.
+   Small objects are allocated in the nursery, and a minor collection
+   is performed when it is full.  Other requests, and small ones when
+   the nursery cannot be emptied, are met from the old space: by
+   bumping a pointer through a free block of at least BUMPBLOCKSIZE
+   bytes, normally pages emptied by the collector, or from the holes
+   in the free lists when no such block is left.  Either way, the next
+   chunk of the heap left unswept by gc() is swept before giving up.
+   Requests for more than LOSTHRESHOLD bytes are met from the large
+   object space instead, so that big arrays do not fragment the heap.
 */
 void *MyHeapAlloc( int size ) {
     /* we need size bytes plus more for the size field that precedes
-       the block in memory, and we round up to a multiple of 4 */
-    int offset, diff, blocksize;
-    FreeStorageBlock *blockPtr, *prevBlockPtr, *newBlockPtr;
-    int minSizeNeeded = (size + sizeof(blockPtr->size) + 3) & 0xfffffffc;
-
-    // we use the top bit for marking and therefore our size 
-    //  is bound to be between 0 and 2^31-1
-    if (size < MINBLOCKSIZE || size > MAXBLOCKSIZE) {
-      fprintf(stderr, 
+       the block in memory, and we round up to a multiple of 8 */
+    FreeStorageBlock *blockPtr = NULL;
+    int minSizeNeeded = (size + sizeof(blockPtr->size) + HEAPALIGN-1) & ~(HEAPALIGN-1);
+
+    // the size of a block is bound to be between 0 and 2^31-1
+    if (size < MINBLOCKSIZE-4 || size > MAXBLOCKSIZE) {
+      fprintf(stderr,
 	      "request for invalid amount of heap - req: %d, max: %d, min: %d\n",
-	      size, MAXBLOCKSIZE, MINBLOCKSIZE);
+	      size, MAXBLOCKSIZE, MINBLOCKSIZE-4);
       exit(1);
     }
 
     if (tracingExecution & TRACE_HEAP)
         fprintf(stdout, "* heap allocation request of size %d (augmented to %d)\n",
             size, minSizeNeeded);
-    blockPtr = prevBlockPtr = NULL;
-    offset = offsetToFirstBlock;
-    while(offset >= 0) {
-        searchCount++;
-        blockPtr = (FreeStorageBlock*)(HeapStart + offset);
-        /* the following check should be quite unnecessary, but is
-           a good idea to have while debugging */
-        if ((offset&3) != 0 || (uint8_t*)blockPtr >= HeapEnd) {
-            fprintf(stderr,
-                "corrupted block in the free list -- bad next offset pointer\n");
-            exit(1);
-        }
-        blocksize = blockPtr->size;
-        /* the following check should be quite unnecessary, but is
-           a good idea to have while debugging */
-        if (blocksize < MINBLOCKSIZE || (blocksize&3) != 0) {
-            fprintf(stderr,
-                "corrupted block in the free list -- bad size field\n");
-            exit(1);
+    if (ConcurrentMarking && __atomic_load_n(&markingDone, __ATOMIC_ACQUIRE))
+        gc();
+    if (minSizeNeeded > LOSTHRESHOLD) {
+        blockPtr = allocateLarge(minSizeNeeded);
+    } else if (minSizeNeeded <= LARGEOBJECTSIZE) {
+        while((blockPtr = allocateYoung(minSizeNeeded)) == NULL && sweepChunk())
+            ;
+        if (blockPtr == NULL && numNurseryPages > 0) {
+            minorGc();
+            if (ConcurrentMark
+                    && oldBytesAllocated > freeAfterGc / 100 * CONCURRENTSTART)
+                startConcurrentMark();
+            blockPtr = allocateYoung(minSizeNeeded);
         }
-        diff = blocksize - minSizeNeeded;
-        if (diff >= 0) break;
-        offset = blockPtr->offsetToNextBlock;
-        prevBlockPtr = blockPtr;
     }
-    if (offset < 0) {
+    while(blockPtr == NULL && minSizeNeeded <= LOSTHRESHOLD) {
+        lockHeap();
+        blockPtr = allocateOld(minSizeNeeded);
+        unlockHeap();
+        if (blockPtr != NULL)
+            oldBytesAllocated += blockPtr->size;
+        else if (!sweepChunk())
+            break;
+    }
+    if (blockPtr == NULL) {
         static int gcAlreadyPerformed = 0;
         void *result;
         if (gcAlreadyPerformed) {
-            /* we are in a recursive call to MyAlloc after a gc */
+            /* we are in a recursive call to MyAlloc after a gc, which
+               did not free enough; the heap grows if it still can */
+            if (minSizeNeeded <= LOSTHRESHOLD && growHeap(minSizeNeeded))
+                return MyHeapAlloc(size);
             fprintf(stderr,
                 "\nHeap exhausted! Unable to allocate %d bytes\n", size);
             exit(1);
         }
+        if (ConcurrentMarking) {
+            /* completing the concurrent mark frees only what was dead
+               when it began; a full gc follows if that is not enough */
+            gc();
+            return MyHeapAlloc(size);
+        }
         gc();
         gcAlreadyPerformed = 1;
         result = MyHeapAlloc(size);
@@ -309,58 +1434,69 @@ void *MyHeapAlloc( int size ) {
         gcAlreadyPerformed = 0;
         return result;
     }
-    /* we have a sufficiently large block of free storage, now determine
-       if we will have a significant amount of storage left over after
-       taking what we need */
-    if (diff < MINBLOCKSIZE) {
-        /* we will return the entire free block that we found, so
-           remove the block from the free list  */
-        if (prevBlockPtr == NULL)
-            offsetToFirstBlock = blockPtr->offsetToNextBlock;
-        else
-            prevBlockPtr->offsetToNextBlock = blockPtr->offsetToNextBlock;
-        if (tracingExecution & TRACE_HEAP)
-            fprintf(stdout, "* free list block of size %d used\n", blocksize);
-    } else {
-        /* we split the free block that we found into two pieces;
-           blockPtr refers to the piece we will return;
-           newBlockPtr will refer to the remaining piece */
-        blockPtr->size = minSizeNeeded;
-        newBlockPtr = (FreeStorageBlock*)((uint8_t*)blockPtr + minSizeNeeded);
-        /* replace the block in the free list with the leftover piece */
-        if (prevBlockPtr == NULL)
-            offsetToFirstBlock += minSizeNeeded;
-        else
-            prevBlockPtr->offsetToNextBlock += minSizeNeeded;
-        newBlockPtr->size = diff;
-        newBlockPtr->offsetToNextBlock = blockPtr->offsetToNextBlock;
-        *(uint32_t *)newBlockPtr->restOfBlock = FREELISTBITPATTERN;
-        
-        if (tracingExecution & TRACE_HEAP)
-            fprintf(stdout, "* free list block of size %d split into %d + %d\n",
-		    diff+minSizeNeeded, minSizeNeeded, diff);
-    }
-    blockPtr->offsetToNextBlock = 0;  /* remove this info from the returned block */
-    totalBytesRequested += minSizeNeeded;
+    totalBytesRequested += blockPtr->size;
     numAllocations++;
-    
-    // Remove the FREELISTBITPATTERN
-    *(uint32_t *)blockPtr->restOfBlock = 0;
+    if ((uint8_t*)blockPtr >= LosStart)
+        return (uint8_t*)blockPtr + sizeof(blockPtr->size);
+    setObjectStart((uint32_t*)blockPtr);
+    if (ConcurrentMarking && testAndSetMark((uint32_t*)blockPtr))
+        __atomic_fetch_add(&pageLive[HEAP_OFFSET(blockPtr) / HEAPPAGESIZE],
+            blockPtr->size, __ATOMIC_RELAXED);
+
+    // Remove the FREELISTBITPATTERN and the rest of the old contents
+    memset((uint8_t*)blockPtr + sizeof(blockPtr->size), 0,
+        blockPtr->size - sizeof(blockPtr->size));
 
     return (uint8_t*)blockPtr + sizeof(blockPtr->size);
 }
 
 
+/* Returns a zeroed block of size bytes from the metaspace, preceded by
+   a size field as in the heap, for a ClassType.  The classes are not in
+   the Java heap, so they are neither moved nor freed, and they are not
+   traced by the collector; instead, the reference fields among their
+   static fields are roots.  Pages are mapped as the metaspace fills. */
+void *MetaspaceAlloc( int size ) {
+    int minSizeNeeded = (size + sizeof(uint32_t) + HEAPALIGN-1) & ~(HEAPALIGN-1);
+    uint8_t *block = MetaspaceTop, *end;
+
+    if (size < 0 || minSizeNeeded > LosStart - block) {
+        fprintf(stderr, "\nMetaspace exhausted! Unable to allocate %d bytes\n", size);
+        exit(1);
+    }
+    if (block + minSizeNeeded > metaspaceCommitted) {
+        end = block + (minSizeNeeded + osPageSize - 1) / osPageSize * osPageSize;
+        if (end > LosStart)
+            end = LosStart;
+        if (mprotect(metaspaceCommitted, end - metaspaceCommitted,
+                PROT_READ|PROT_WRITE) != 0) {
+            fprintf(stderr, "unable to map %ld bytes of metaspace\n",
+                (long)(end - metaspaceCommitted));
+            exit(1);
+        }
+        metaspaceCommitted = end;
+    }
+    if (tracingExecution & TRACE_HEAP)
+        fprintf(stdout, "* metaspace allocation request of size %d\n", size);
+    MetaspaceTop += minSizeNeeded;
+    *(uint32_t*)block = minSizeNeeded;
+    return block + sizeof(uint32_t);
+}
+
+
 /* When garbage collection is implemented, this function should never
    be called from outside the current file.
    This implementation checks that p is plausible and that the block of
-   memory referenced by p holds a plausible size field.
+   memory referenced by p holds a plausible size field, then adds the
+   block to the end of the list for its size in lists, which sweep()
+   later merges into the free lists.  sweep() has already combined the
+   block with any free neighbours.
 */
-static void MyHeapFree(void *p) {
+static void MyHeapFree(void *p, SweptLists *lists) {
     uint8_t *p1 = (uint8_t*)p;
-    int blockSize;
-    FreeStorageBlock *blockPtr, *freelistBlock;
-	
+    int blockSize, ix;
+    FreeStorageBlock *blockPtr;
+
     if (p1 < HeapStart || p1 >= HeapEnd || ((p1-HeapStart) & 3) != 0) {
         fprintf(stderr, "bad call to MyHeapFree -- bad pointer\n");
         exit(1);
@@ -369,215 +1505,1256 @@ static void MyHeapFree(void *p) {
     p1 -= sizeof(blockPtr->size);
     /* now check the size field for validity */
     blockSize = *(uint32_t*)p1;
-    
-    if (blockSize < MINBLOCKSIZE || (p1 + blockSize) > HeapEnd || (blockSize & 3) != 0) {
+
+    if (blockSize < MINBLOCKSIZE || (p1 + blockSize) > HeapEnd
+            || (blockSize & (HEAPALIGN-1)) != 0) {
         fprintf(stderr, "bad call to MyHeapFree -- invalid block\n");
         exit(1);
     }
-	
-	blockPtr = (FreeStorageBlock*)p1;
-
-	if (offsetToFirstBlock > -1) {
-		// there is already something in the freelist, so see if we can combine
-		freelistBlock = (FreeStorageBlock*) REAL_HEAP_POINTER(offsetToFirstBlock);
-
-		if ( freelistBlock->size + (void*) freelistBlock == blockPtr) {
-			if (tracingExecution & TRACE_HEAP)
-				fprintf(stdout, "Combining Freelist blocks %p and %p\n", 
-						freelistBlock, blockPtr);
-			// p1 is the next block so combine sizes and we are done
-			freelistBlock->size += blockPtr->size;
-			return;
-		}
-	}
-   
+
 	if (tracingExecution & TRACE_GC)
-		fprintf(stdout, "Adding Block to Freelist - Block size = %d" 
+		fprintf(stdout, "Adding Block to Freelist - Block size = %d"
 				" Pointer = %p Heap end = %p\n",
 				blockSize, p1, HeapEnd);
 
-    /* link the block into the free list at the front */
-    blockPtr->offsetToNextBlock = offsetToFirstBlock;
+    blockPtr = (FreeStorageBlock*)p1;
+    clearObjectStarts(p1 - HeapStart, p1 - HeapStart + blockSize);
+    blockPtr->pattern = FREELISTBITPATTERN;
+    blockPtr->offsetToNextBlock = -1;
+    ix = freeListIndex(blockSize);
+    if (lists->first[ix] < 0)
+        lists->first[ix] = p1 - HeapStart;
+    else
+        ((FreeStorageBlock*)HEAP_ADDRESS(lists->last[ix]))->offsetToNextBlock =
+            p1 - HeapStart;
+    lists->last[ix] = p1 - HeapStart;
+}
 
-    // add bit pattern for stuff in freelist
-    *(uint32_t*)blockPtr->restOfBlock = FREELISTBITPATTERN;
-    
-    offsetToFirstBlock = p1 - HeapStart;
+
+#define PAGEOF(p)  (((uint8_t*)(p) - HeapStart) / HEAPPAGESIZE)
+
+/* Stops the object at p, and the others which start in its page, from
+   being moved */
+static void pinPage( void *p ) {
+    if ((uint8_t*)p >= HeapEnd)
+        return;  /* large objects are never moved */
+    __atomic_fetch_or(&pageFlags[PAGEOF(p)], PAGE_PINNED, __ATOMIC_RELAXED);
 }
 
 
-/* This implements garbage collection.
-   It should be called when
-   (a) MyAlloc cannot satisfy a request for a block of memory, or
-   (b) when invoked by the call System.gc() in the Java program.
-*/
-void gc() {
-    gcCount++;
-    
-    if (tracingExecution & TRACE_HEAP) {
-        printf("Starting Garbage Collection...\n");
-        printf("\nMarking Fake_System_Out...\n==========================\n");
+static void markReferents(uint32_t *block);
+static void markSlot( HeapPointer *slot );
+static void processMarkStack();
+
+
+/* Calls visit for each field of the object at block which holds a
+   reference.  The elements of an array of references are references,
+   and the class of an instance, or the class itself, has a map of
+   which of its fields are references.  No other object refers to the
+   heap; the class that an object refers to is in the metaspace. */
+static void forEachReference( uint32_t *block, void (*visit)(HeapPointer *slot) ) {
+    ClassType *ct;
+    int i;
+
+    switch(*block) {
+    case CODE_ARRA: {
+        ArrayOfRef *arr = (ArrayOfRef*)block;
+        for( i = 0;  i < arr->size;  i++ )
+            visit(&arr->elements[i]);
+        break;
+    }
+    case CODE_INST: {
+        ClassInstance *ci = (ClassInstance*)block;
+        ct = INSTANCE_CLASS(ci);
+        if (ct == NULL || ct->instanceRefMap == NULL)
+            break;
+        for( i = 0;  i < ct->numInstanceFields;  i++ )
+            if (IS_REFERENCE_SLOT(ct->instanceRefMap, i))
+                visit(&ci->instField[i].pval);
+        break;
+    }
+    case CODE_CLAS:
+        ct = (ClassType*)block;
+        if (ct->classRefMap == NULL)
+            break;
+        for( i = 0;  i < ct->numClassFields;  i++ )
+            if (IS_REFERENCE_SLOT(ct->classRefMap, i))
+                visit(&ct->classField[i].pval);
+        break;
     }
+}
 
-	// We must mark this fake file descriptor
-	mark(Fake_System_Out);
-    
+/* Calls visit for each static field of the loaded classes which holds
+   a reference, and for each string constant that they have resolved,
+   for the classes dealt out to worker of numWorkers.  These are roots,
+   like the JVM stack, but precise ones.  The interned strings are not:
+   the intern table only refers to them weakly. */
+static void forEachClassRoot( void (*visit)(HeapPointer *slot),
+        int worker, int numWorkers ) {
+    ClassType *ct;
+    int i, j;
+
+    for( ct = FirstLoadedClass, i = 0;  ct != NULL;  ct = ct->nextClass, i++ ) {
+        if (i % numWorkers != worker)
+            continue;
+        forEachReference((uint32_t*)ct, visit);
+        if (ct->stringConstants == NULL)
+            continue;
+        for( j = 0;  j < ct->cf->constant_pool_count;  j++ )
+            if (ct->stringConstants[j] != NULL_HEAP_REFERENCE)
+                visit(&ct->stringConstants[j]);
+    }
+}
+
+/* Marks the object at p, if p appears to be an object, and pins it.
+   This is used for references that the collector could not update:
+   those on the JVM and C stacks. */
+static void markAmbiguous( void *p ) {
+    if (isProbablePointer(p)) {
+        pinPage(p);
+        mark(p);
+    }
+}
+
+
+static void markAmbiguousSlot( HeapPointer *slot ) {
+    markAmbiguous(REAL_HEAP_POINTER(*slot));
+}
+
+
+/* Calls visit for each slot of the JVM stack which holds a reference.
+   A frame's slots are known from the stack map of the method at its
+   current instruction; any other slots are passed to ambiguous, unless
+   that is NULL.  The operand stack of the newest frame is always taken
+   to be ambiguous, as the instruction being executed may have changed
+   it. */
+static void forEachStackReference( void (*visit)(HeapPointer *slot),
+        void (*ambiguous)(HeapPointer *slot) ) {
+    DataItem *limit = JVM_Top + 1, *sp;
+    JVM_Frame *f;
+    uint32_t *map;
+    int numSlots, i;
+
+    for( f = JVM_CurrentFrame;  f != NULL;  f = f->caller ) {
+        map = NULL;
+        if (f->pcp != NULL)
+            map = GetStackMap(f->thisClass->cf, f->method,
+                *f->pcp - 1 - f->method->code, &numSlots);
+        if (map != NULL && f == JVM_CurrentFrame)
+            numSlots = f->method->max_locals;
+        for( sp = f->localVariable;  sp < limit;  sp++ ) {
+            i = sp - f->localVariable;
+            if (map != NULL && i < numSlots) {
+                if (IS_REFERENCE_SLOT(map, i))
+                    visit(&sp->pval);
+            } else if (ambiguous != NULL)
+                ambiguous(&sp->pval);
+        }
+        limit = f->localVariable;
+    }
+    /* values pushed before the first method was invoked */
+    if (ambiguous != NULL) {
+        for( sp = JVM_Stack;  sp < limit;  sp++ )
+            ambiguous(&sp->pval);
+    }
+}
+
+
+/* Scans the C stack of the thread running the Java program, from the
+   caller's frame to the base, for anything that might refer to the
+   heap: a pointer, or a HeapPointer offset.  C functions which called
+   MyHeapAlloc may be holding such references in local variables or in
+   registers, and a pointer may be into the middle of an object. */
+static void scanCStack() {
+    jmp_buf regs;
+    uint8_t *start, *sp, *p;
+    uint32_t *obj, ref;
+
+    setjmp(regs);  /* puts the callee-saved registers on the stack */
+    start = (uint8_t*)(((uintptr_t)&regs + sizeof(void*) - 1)
+        & ~(uintptr_t)(sizeof(void*) - 1));
+
+    /* pointers are aligned, so they are read a whole word at a time */
+    for( sp = start;  sp + sizeof(void*) <= (uint8_t*)cStackBase;
+            sp += sizeof(void*) ) {
+        memcpy(&p, sp, sizeof(p));
+        if (p >= HeapStart && p < HeapEnd) {
+            if ((obj = objectContaining(p)) != NULL) {
+                pinPage(obj);
+                mark(obj);
+            }
+        } else if ((obj = largeObjectAt(p)) != NULL)
+            mark(obj);
+    }
+
+    /* a HeapPointer may be in either half of a word */
+    for( sp = start;  sp + sizeof(uint32_t) <= (uint8_t*)cStackBase;
+            sp += sizeof(uint32_t) ) {
+        memcpy(&ref, sp, sizeof(ref));
+        if (ref < MAKE_HEAP_REFERENCE(LosEnd))
+            markAmbiguous(REAL_HEAP_POINTER(ref));
+    }
+}
+
+
+/* Chooses the pages whose objects will be evacuated.  A page is chosen
+   if it holds no pinned objects and is no more than EVACUATIONLIMIT
+   percent full, emptiest pages first, for as long as the objects can be
+   copied into the free space outside the chosen pages. */
+static int chooseEvacuationPages() {
+    long freeOutside = MaxHeapPtr, toCopy = 0;
+    int *order, n = 0, i, j, chosen = 0;
+
+    for( i = 0;  i < numHeapPages;  i++ )
+        freeOutside -= pageLive[i];
+    order = SafeCalloc(numHeapPages+1, sizeof(int));
+    for( i = 0;  i < numHeapPages;  i++ ) {
+        if (pageFlags[i] & PAGE_PINNED)
+            continue;
+        if (pageLive[i] == 0 || pageLive[i] > HEAPPAGESIZE*EVACUATIONLIMIT/100)
+            continue;
+        /* insertion sort by occupancy */
+        for( j = n++;  j > 0 && pageLive[order[j-1]] > pageLive[i];  j-- )
+            order[j] = order[j-1];
+        order[j] = i;
+    }
+    for( i = 0;  i < n;  i++ ) {
+        uint32_t live = pageLive[order[i]];
+        /* keep an eighth of the space spare, as the free space is in pieces */
+        if (toCopy + live > (freeOutside - (HEAPPAGESIZE - live)) * 7 / 8)
+            break;
+        toCopy += live;
+        freeOutside -= HEAPPAGESIZE - live;
+        pageFlags[order[i]] |= PAGE_EVACUATE;
+        chosen++;
+    }
+    SafeFree(order);
+    return chosen;
+}
+
+
+/* The block that evacuated objects are copied into, as for bumpPtr */
+static uint8_t *copyPtr = NULL, *copyLimit = NULL;
+
+/* Returns a block of exactly size bytes for an evacuated object, or
+   NULL if there is no free space for it */
+static FreeStorageBlock *allocateCopy( int size ) {
+    FreeStorageBlock *blockPtr;
+
+    if (copyLimit - copyPtr < size) {
+        if (copyLimit - copyPtr >= MINBLOCKSIZE)
+            addToFreeList(copyPtr - HeapStart);
+        copyPtr = copyLimit = NULL;
+        blockPtr = findFreeBlock(size < BUMPBLOCKSIZE? BUMPBLOCKSIZE : size);
+        if (blockPtr == NULL)
+            blockPtr = findFreeBlock(size);
+        if (blockPtr == NULL)
+            return NULL;
+        copyPtr = (uint8_t*)blockPtr;
+        copyLimit = copyPtr + blockPtr->size;
+    }
+    blockPtr = (FreeStorageBlock*)copyPtr;
+    if (splitFreeBlock(blockPtr, size) == 0 && blockPtr->size != size) {
+        /* the rest would be too small to be a free block */
+        copyPtr = copyLimit = NULL;
+        return allocateCopy(size);
+    }
+    copyPtr += size;
+    if (copyPtr == copyLimit)
+        copyPtr = copyLimit = NULL;
+    return blockPtr;
+}
+
+
+/* Puts what is left of the copy block back into the free lists */
+static void retireCopyBlock() {
+    if (copyLimit - copyPtr >= MINBLOCKSIZE)
+        addToFreeList(copyPtr - HeapStart);
+    copyPtr = copyLimit = NULL;
+}
+
+
+/* Copies the marked object whose size field is at sizePtr into the old
+   space, and leaves the kind code CODE_FWRD and the new address of the
+   object in its place.  The result is the size field of the copy, or
+   NULL if there is no room for it. */
+static uint32_t *moveObject( uint32_t *sizePtr ) {
+    uint32_t size = *sizePtr;
+    uint32_t *copy = (uint32_t*)allocateCopy(size);
+
+    if (copy == NULL)
+        return NULL;
+    memcpy(copy, sizePtr, size);
+    setObjectStart(copy);
+    clearObjectStarts(HEAP_OFFSET(sizePtr), HEAP_OFFSET(sizePtr) + size);
+    clearMark(sizePtr);
+    sizePtr[1] = CODE_FWRD;
+    sizePtr[2] = MAKE_HEAP_REFERENCE(copy + 1);
     if (tracingExecution & TRACE_HEAP)
-        printf("\nMarking Classes...\n==================\n");
-
-	// The class list is a linked list so mark, being recursive,
-	//  should get all the class files on the heap. However, to
-	//  be really safe call mark on all the classfiles manually
-	ClassType *ct = FirstLoadedClass;
-	while (ct) {
-        if (tracingExecution & TRACE_HEAP) {
-            printf("Class: %p, nextClass: %p\n", ct, ct->nextClass);
+        printf("* object at %p moved to %p\n", sizePtr+1, copy+1);
+    return copy;
+}
+
+
+/* Copies the live objects out of the pages chosen for evacuation.  Each
+   object left behind is overwritten with the kind code CODE_FWRD and the
+   new address of the object.  An object is left where it is, still
+   marked, if there is no room for the copy. */
+static void evacuate() {
+    HeapOffset hp = 0;
+
+    while(hp < MaxHeapPtr) {
+        uint32_t *sizePtr = HEAP_ADDRESS(hp);
+        uint32_t size = *sizePtr;
+
+        if (isMarked(sizePtr) && (pageFlags[hp/HEAPPAGESIZE] & PAGE_EVACUATE)) {
+            if (moveObject(sizePtr) != NULL) {
+                objectsEvacuated++;
+                bytesEvacuated += size;
+            }
         }
-		mark(ct);
-		ct = ct->nextClass;
-	}
-    
-	if (tracingExecution & TRACE_HEAP)
-        printf("\nMarking Stack...\n================\n");
-    
+        hp += size;
+    }
+    retireCopyBlock();
+}
+
+
+/* Returns the new address of the object that hp refers to, if it was
+   evacuated */
+static HeapPointer forwarded( HeapPointer hp ) {
+    uint32_t *obj = REAL_HEAP_POINTER(hp);
+    return (hp != NULL_HEAP_REFERENCE && obj[0] == CODE_FWRD)? obj[1] : hp;
+}
+
+static void forwardSlot( HeapPointer *slot ) {
+    *slot = forwarded(*slot);
+}
+
+
+/* After evacuation, updates the references to the evacuated objects and
+   rebuilds the free lists, with the space that the objects occupied.
+   The references are all updated first, as the forwarding addresses are
+   lost when the free lists are rebuilt. */
+static void updateReferences() {
+    HeapOffset runStart = -1;  /* the free block being built, or -1 */
+    LargeObject *lo;
+    HeapOffset hp;
+
+    for( hp = 0;  hp < MaxHeapPtr;  hp += *(uint32_t *)HEAP_ADDRESS(hp) ) {
+        uint32_t *sizePtr = HEAP_ADDRESS(hp);
+        if (sizePtr[1] != FREELISTBITPATTERN && sizePtr[1] != CODE_FWRD)
+            forEachReference(sizePtr + 1, forwardSlot);
+    }
+    for( lo = nextLargeObject(NULL);  lo != NULL;  lo = nextLargeObject(lo) )
+        forEachReference((uint32_t*)((uint8_t*)lo + LOSOBJECTOFFSET), forwardSlot);
+    forEachStackReference(forwardSlot, NULL);
+    forEachClassRoot(forwardSlot, 0, 1);
+    ForEachInternedString(forwardSlot);
+
+    clearFreeLists();
+    hp = 0;
+    while(hp < MaxHeapPtr) {
+        uint32_t *sizePtr = HEAP_ADDRESS(hp);
+        uint32_t size = *sizePtr;
+
+        if (sizePtr[1] == FREELISTBITPATTERN || sizePtr[1] == CODE_FWRD) {
+            if (runStart < 0)
+                runStart = hp;
+        } else {
+            /* a live object, perhaps one which could not be moved */
+            if (runStart >= 0)
+                freeRange(runStart, hp);
+            runStart = -1;
+        }
+        hp += size;
+    }
+    if (runStart >= 0)
+        freeRange(runStart, hp);
+}
+
+
+/* Scans the objects on the pages whose cards are marked, and the large
+   objects whose first cards are marked.  If update is 0, the young
+   objects that old objects refer to are marked; otherwise the references
+   to moved objects are updated. */
+static void scanDirtyCards( int update ) {
+    LargeObject *lo;
+    HeapOffset hp;
+
+    for( hp = 0;  hp < MaxHeapPtr;  hp += *(uint32_t *)HEAP_ADDRESS(hp) ) {
+        uint32_t *sizePtr = HEAP_ADDRESS(hp);
+        int page = hp / HEAPPAGESIZE;
+
+        if (!CardTable[page] || sizePtr[1] == FREELISTBITPATTERN
+                || sizePtr[1] == CODE_FWRD)
+            continue;
+        if (!update) {
+            if (!(pageFlags[page] & PAGE_NURSERY))
+                markReferents(sizePtr + 1);
+        } else
+            forEachReference(sizePtr + 1, forwardSlot);
+    }
+    for( lo = nextLargeObject(NULL);  lo != NULL;  lo = nextLargeObject(lo) ) {
+        uint32_t *block = (uint32_t*)((uint8_t*)lo + LOSOBJECTOFFSET);
+
+        if (!LosCardTable[((uint8_t*)lo - LosStart) / LOSCARDSIZE])
+            continue;
+        if (!update)
+            markReferents(block);
+        else
+            forEachReference(block, forwardSlot);
+    }
+}
+
+
+/* Returns 1 if the object which ref refers to survives the collection
+   whose marking has just finished.  A minor collection keeps all of the
+   old objects and the large ones. */
+static int survivesCollection( HeapPointer ref ) {
+    uint8_t *p = REAL_HEAP_POINTER(ref);
+
+    if (p >= LosStart) {
+        uint32_t *obj = largeObjectAt(p);
+        return obj == NULL || collectingNursery
+            || ((LargeObject*)((uint8_t*)obj - LOSOBJECTOFFSET))->marked;
+    }
+    if (p < HeapStart || p >= HeapStart + MaxHeapPtr)
+        return 1;
+    if (collectingNursery && !(pageFlags[PAGEOF(p)] & PAGE_NURSERY))
+        return 1;
+    return isMarked((uint32_t*)p - 1);
+}
+
+
+/* A minor collection, performed when the nursery is full.
+   The young objects reachable from the roots, or from old objects on
+   pages with marked cards, are marked; the old objects are assumed to
+   be live.  The marked objects are moved to the old space, except for
+   those on pinned pages, which stay where they are and become old.
+   The whole pages left free in the nursery runs form the new nursery,
+   and pages are taken from the old space as well if it has shrunk to
+   half its size.  Either way, there are no young objects afterwards. */
+static void minorGc() {
+    HeapOffset *runs, hp, runStart;
+    int i, numRuns, all = numHeapPages;
+    long startTime = nanoTime();
+
+    finishSweep();
+    minorGcCount++;
+    if (tracingExecution & TRACE_HEAP)
+        printf("* minor collection of %d nursery pages\n", numNurseryPages);
+    youngPtr = youngLimit = NULL;
+    for( i = 0;  i < numHeapPages;  i++ )
+        pageFlags[i] &= ~(PAGE_PINNED|PAGE_EVACUATE);
+    memset(markBits, 0, MaxHeapPtr/32 + 1);
+
+    collectingNursery = 1;
+    processMarkStack();
+    PruneInternedStrings(survivesCollection);
+    collectingNursery = 0;
+
+    /* move the survivors which are not pinned */
+    for( i = 0;  i < numNurseryRuns;  i++ ) {
+        for( hp = nurseryRuns[2*i];  hp < nurseryRuns[2*i+1];  ) {
+            uint32_t *sizePtr = HEAP_ADDRESS(hp);
+            uint32_t size = *sizePtr;
+            uint32_t *copy;
+
+            if (isMarked(sizePtr) && !(pageFlags[hp/HEAPPAGESIZE] & PAGE_PINNED)) {
+                copy = moveObject(sizePtr);
+                if (copy != NULL) {
+                    CardTable[HEAP_OFFSET(copy) / HEAPPAGESIZE] = 1;
+                    objectsPromoted++;
+                    bytesPromoted += size;
+                    oldBytesAllocated += size;
+                }
+            }
+            if (isMarked(sizePtr))
+                CardTable[hp/HEAPPAGESIZE] = 1;  /* it stays here */
+            hp += size;
+        }
+    }
+    retireCopyBlock();
+    scanDirtyCards(1);
+    forEachStackReference(forwardSlot, NULL);
+    forEachClassRoot(forwardSlot, 0, 1);
+    ForEachInternedString(forwardSlot);
+
+    /* free the space in the nursery runs around the objects which stay */
+    runs = nurseryRuns;
+    numRuns = numNurseryRuns;
+    nurseryRuns = oldNurseryRuns;
+    oldNurseryRuns = runs;
+    numNurseryRuns = nextNurseryRun = numNurseryPages = 0;
+    for( i = 0;  i < numRuns;  i++ ) {
+        for( hp = runs[2*i];  hp < runs[2*i+1];  hp += HEAPPAGESIZE )
+            pageFlags[hp/HEAPPAGESIZE] &= ~PAGE_NURSERY;
+        runStart = runs[2*i];
+        for( hp = runs[2*i];  hp < runs[2*i+1];  ) {
+            uint32_t *sizePtr = HEAP_ADDRESS(hp);
+            uint32_t size = *sizePtr;
+
+            if (isMarked(sizePtr)) {
+                objectsPromoted++;
+                bytesPromoted += size;
+                oldBytesAllocated += size;
+                if (hp > runStart)
+                    carveRange(runStart, hp, &all);
+                runStart = hp + size;
+            }
+            hp += size;
+        }
+        if (runStart < runs[2*i+1])
+            carveRange(runStart, runs[2*i+1], &all);
+    }
+    clearCards();
+    if (numNurseryPages < numHeapPages / NURSERYFRACTION / 2)
+        carveNursery();
+    gcNanos += nanoTime() - startTime;
+}
+
+
+/* Prepares for marking the whole heap, as part of the old space */
+static void beginMarking() {
+    LargeObject *lo;
+
+    if (tracingExecution & TRACE_HEAP)
+        printf("Starting Garbage Collection...\n");
     if (tracingExecution & TRACE_GC)  {
         printf("State of stack is as follows.\n");
         printStack();
     }
-    
-    DataItem *Stack_Iterator = JVM_Top;
-    while(Stack_Iterator >= JVM_Stack) {
-        if(isProbablePointer(REAL_HEAP_POINTER(Stack_Iterator->pval))) {
-              mark(REAL_HEAP_POINTER(Stack_Iterator->pval));
+    finishSweep();
+    gcCount++;
+    retireBumpBlock();
+    retireNursery();
+    clearCards();
+    memset(pageFlags, 0, numHeapPages);
+    memset(markBits, 0, MaxHeapPtr/32 + 1);
+    memset(pageLive, 0, numHeapPages*sizeof(uint32_t));
+    for( lo = nextLargeObject(NULL);  lo != NULL;  lo = nextLargeObject(lo) )
+        lo->marked = 0;
+}
+
+
+/* Unmaps the large objects which were not marked */
+static void sweepLargeObjects() {
+    LargeObject *lo, *next;
+
+    for( lo = nextLargeObject(NULL);  lo != NULL;  lo = next ) {
+        next = nextLargeObject(lo);
+        if (!lo->marked)
+            freeLargeObject(lo);
+    }
+}
+
+
+/* Returns the offset of the last marked object, or 0 if there is none */
+static HeapOffset lastMark() {
+    long ix;
+
+    for( ix = MaxHeapPtr/4 - 1;  ix >= 0;  ix-- ) {
+        if (markBits[ix >> 3] == 0)
+            ix &= ~7;
+        else if ((markBits[ix >> 3] >> (ix & 7)) & 1)
+            return ix * 4;
+    }
+    return 0;
+}
+
+
+/* Shrinks the heap, after marking, to newSize bytes or to just past the
+   last marked block, whichever is bigger.  The dead objects beyond that
+   block are discarded with the space. */
+static void shrinkAfterMarking( long newSize ) {
+    HeapOffset hp = lastMark(), end = hp, limit;
+    long bytesRecovered = 0;
+    int blocksRecovered = 0;
+
+    /* find the end of the last marked block; the walk must start from
+       the start of a block */
+    while(hp < MaxHeapPtr) {
+        uint32_t *sizePtr = HEAP_ADDRESS(hp);
+
+        if (isMarked(sizePtr)) {
+            end = hp + *sizePtr;
+            bytesRecovered = blocksRecovered = 0;
+        } else if (sizePtr[1] != FREELISTBITPATTERN) {
+            bytesRecovered += *sizePtr;
+            blocksRecovered++;
         }
-        Stack_Iterator--;
+        hp += *sizePtr;
+    }
+    limit = (end + MINBLOCKSIZE + HEAPPAGESIZE - 1) & ~(HEAPPAGESIZE - 1);
+    if (newSize < limit)
+        newSize = limit;
+    if (newSize >= MaxHeapPtr)
+        return;
+    clearObjectStarts(end, MaxHeapPtr);
+    ((FreeStorageBlock*)HEAP_ADDRESS(end))->size = newSize - end;
+    ((FreeStorageBlock*)HEAP_ADDRESS(end))->pattern = FREELISTBITPATTERN;
+    totalBytesRecovered += bytesRecovered;
+    totalBlocksRecovered += blocksRecovered;
+    shrinkHeap(newSize);
+}
+
+
+/* Resizes the heap after marking, when live bytes were found live.  The
+   heap grows to leave MINHEAPFREE percent of it free, or shrinks to
+   leave MAXHEAPFREE percent free.  Between those, it grows by half if
+   the program has been spending more than GCTIMELIMIT percent of its
+   time in the collector.  It stays between its initial size and
+   MaxHeapSize. */
+static void sizeHeap( long live ) {
+    long now = nanoTime(), size = MaxHeapPtr, target = size;
+    int busy = 0;
+
+    if (now > lastSizing)
+        busy = (gcNanos + now - gcStartTime) * 100 / (now - lastSizing) > GCTIMELIMIT;
+    gcNanos = 0;
+    lastSizing = now;
+    if (live * 100 > size * (100 - MINHEAPFREE))
+        target = live * 100 / (100 - MINHEAPFREE);
+    else if (live * 100 < size * (100 - MAXHEAPFREE))
+        target = live * 100 / (100 - MAXHEAPFREE);
+    else if (busy)
+        target = size + size/2;
+    target = (target + HEAPPAGESIZE - 1) & ~(HEAPPAGESIZE - 1);
+    if (target > MaxHeapSize)
+        target = MaxHeapSize;
+    if (target < initialHeapSize)
+        target = initialHeapSize;
+    if (target > size)
+        extendHeap(target);
+    else if (target < size)
+        shrinkAfterMarking(target);
+}
+
+
+/* This implements garbage collection.
+   It should be called when
+   (a) MyAlloc cannot satisfy a request for a block of memory, or
+   (b) when invoked by the call System.gc() in the Java program.
+
+   The collector is mostly-copying.  Marking finds the live objects and
+   pins those which are referred to in ways the collector cannot update:
+   from the C stack, from JVM stack slots which the stack maps do not
+   describe, or, for a ClassType, by C pointers.  The references in
+   objects are known precisely, from the elements of arrays of references
+   and the reference maps of the classes.  Pinned
+   objects, and large objects, stay where they are and sweep() frees the
+   dead objects around them.  The live objects on sparsely occupied pages
+   with no pinned objects are evacuated, which frees those pages entirely;
+   MyHeapAlloc then allocates from them by bumping a pointer.  Dead
+   objects in the large object space are unmapped straight away.
+   When no pages are evacuated, the sweep is left to MyHeapAlloc, which
+   sweeps the heap a chunk at a time as it needs space; see startSweep().
+   This is a full collection: the nursery is first made part of the old
+   space, and a new nursery is taken from the free pages afterwards.
+   If a concurrent mark is under way, it is completed instead, and no
+   pages are evacuated, so that the pause does not depend on the size
+   of the heap.  The heap is resized, by sizeHeap(), before it is swept.
+*/
+void gc() {
+    int i, pinned = 0, chosen = 0, concurrent = ConcurrentMarking;
+    long live = 0;
+
+    gcStartTime = nanoTime();
+    if (concurrent) {
+        finishConcurrentMark();
+    } else {
+        beginMarking();
+
+        // The fake file descriptor, the C and JVM stacks and the class roots
+        //  are marked by the gc threads, which then drain the mark deques of
+        //  everything they refer to; see processMarkStack()
+        processMarkStack();
+    }
+    PruneInternedStrings(survivesCollection);
+    sweepLargeObjects();
+
+    for( i = 0;  i < numHeapPages;  i++ ) {
+        if (pageFlags[i] & PAGE_PINNED)
+            pinned++;
+        live += pageLive[i];
     }
-      
+    totalPagesPinned += pinned;
+    sizeHeap(live);
+    if (!concurrent)
+        chosen = chooseEvacuationPages();
+    freeAfterGc = MaxHeapPtr - live;
+    oldBytesAllocated = 0;
+
     if (tracingExecution & TRACE_HEAP)
         printf("\nSweeping...\n===========\n");
     if (tracingExecution & TRACE_GC)
         printf("State of heap prior to sweep is as follows.\n");
-    if (tracingExecution & TRACE_GC) 
-        printHeap();
-    
-    sweep();
-    
     if (tracingExecution & TRACE_GC)
+        printHeap();
+
+    if (chosen > 0) {
+        if (tracingExecution & TRACE_HEAP)
+            printf("* evacuating %d of %d pages (%d pinned)\n",
+                chosen, numHeapPages, pinned);
+        sweep();
+        evacuate();
+        updateReferences();
+        carveNursery();
+        uncommitFreePages();
+    } else if (SweepMode == SWEEP_EAGER) {
+        sweep();
+        carveNursery();
+        uncommitFreePages();
+    } else {
+        startSweep();
+    }
+
+    if (tracingExecution & TRACE_GC) {
+        finishSweep();
         printf("\nState of heap following sweep is as follows.\n");
-    if (tracingExecution & TRACE_GC) 
         printHeap();
-    
+    }
+    gcNanos += nanoTime() - gcStartTime;
 }
 
-/* Returns 1 if the pointer p is a valid pointer into the 
+/* Returns 1 if the pointer p is a valid pointer into the
    java heap, 0 otherwise */
 int isProbablePointer(void *p) {
-    
-	// check the pointer is valid
-	if ( (uint8_t) p % 4 || // must be 4 byte alligned
-		 // the first valid pointer is HeapStart + 4
-		 p < (void*)(HeapStart + 4) ||
-		 // and the last is HeapEnd - MINBLOCKSIZE
-		 p > ( (void*)(HeapEnd - MINBLOCKSIZE) )) {
-		return 0;
+
+	// a large object is a fixed distance into the first of its pages
+	if ((uint8_t*)p >= LosStart && (uint8_t*)p < LosEnd) {
+		long offset = (uint8_t*)p - LosStart;
+		return losPageState[offset / osPageSize] == LOS_FIRST
+			&& offset % osPageSize == LOSOBJECTOFFSET;
 	}
-	
-	// check the block has a valid size
-	uint32_t blockSize = *( ((uint32_t*) p) - 1 );
-	if (blockSize > MAXBLOCKSIZE || 
-		blockSize < MINBLOCKSIZE || 
-		blockSize > (HeapEnd - HeapStart) ||
-		blockSize % 4) { // block sizes are always a multiple of 4
+
+	// an object in the heap follows its size field, which is 8 byte
+	//  aligned, and has its bit set in the object-start bitmap
+	if ((uint8_t*)p < HeapStart + 4 || (uint8_t*)p >= HeapEnd
+			|| ((uint8_t*)p - HeapStart) % HEAPALIGN != 4)
 		return 0;
-	}
-	
-	// check if the block has a valid kind field
-	switch(*(uint32_t *)p) {
-        case CODE_ARRA:
-        case CODE_ARRS:
-        case CODE_CLAS:
-        case CODE_INST:
-        case CODE_STRG:
-        case CODE_SBLD:
-            break;    
-        default:
-            return 0; 
-    };
-
-	return 1; 
-}
-
-
-/* Mark the leftmost bit of the size field for an object
-    on the heap. We then go through the data portion and 
-    check for other pointers to mark */
+	return isObjectStart((uint32_t*)p - 1);
+}
+
+
+/* Mark an object on the heap by setting its bit in the mark bitmap.
+    The object is pushed on the mark deque of this gc thread, and the
+    objects that it refers to are marked when it is popped, or stolen by
+    another gc thread, in drainMarkDeques(). */
 void mark(uint32_t *block) {
-	uint32_t size, i;
 
 	// back up 4 bytes to get at the size field of the block
 	uint32_t *blockMetadata = block - 1;
-	
-	if ( !(*blockMetadata & MARKBIT) ) {
+
+	if ((uint8_t*)block >= LosStart) {
+		// a large object is old, and is marked in its header
+		LargeObject *lo = (LargeObject*)((uint8_t*)block - LOSOBJECTOFFSET);
+		if (!collectingNursery
+				&& !__atomic_exchange_n(&lo->marked, 1, __ATOMIC_RELAXED)
+				&& !pushMark(&markDeques[gcThreadNum], block))
+			__atomic_store_n(&markStackOverflowed, 1, __ATOMIC_RELAXED);
+		return;
+	}
+
+	// a minor collection marks only the young objects
+	if (collectingNursery && !(pageFlags[PAGEOF(block)] & PAGE_NURSERY))
+		return;
+	if ( testAndSetMark(blockMetadata) ) {
 		if (tracingExecution & TRACE_HEAP)
 			fprintf(stdout, "mark(): Marking ptr %p\n", block);
 
-        // iterate over the number of remaining 32bit spots
-        size = (*blockMetadata - 4) / sizeof(uint32_t);
-        
-		*blockMetadata |= MARKBIT; // set the mark bit
-		for (i = 0; i < size; i++) {
-			if ( isProbablePointer((uint32_t*) REAL_HEAP_POINTER(block[i])) ) {
-				mark((uint32_t*) REAL_HEAP_POINTER(block[i]));
-			}
-		}
+        __atomic_fetch_add(&pageLive[PAGEOF(blockMetadata)], *blockMetadata,
+            __ATOMIC_RELAXED);
+        // large objects are not worth moving
+        if (*blockMetadata > LARGEOBJECTSIZE)
+            __atomic_fetch_or(&pageFlags[PAGEOF(blockMetadata)], PAGE_PINNED,
+                __ATOMIC_RELAXED);
+
+        if (!pushMark(&markDeques[gcThreadNum], block)) {
+            // it will be found again by scanning the heap
+            __atomic_store_n(&markStackOverflowed, 1, __ATOMIC_RELAXED);
+            return;
+        }
+        __builtin_prefetch(block);
 	}
 }
 
-/* Sweep over the heap collecting garbage. This is accomplished
-    by rebuilding the freelist. Anything that was not marked by
-    the mark function is put into the new freelist by MyHeapFree().
-*/
-void sweep() {
+/* Marks the objects referred to by the objects on the mark deques, and
+    so on, until all of them are empty.  Each gc thread works on its own
+    deque, stealing from the others when it runs out, and returns only
+    when every thread has run out. */
+static void drainMarkDeques( int worker ) {
+    uint32_t *block;
+    int i;
 
-	// we rebuild the freelist at each gc, so reset it!
-    offsetToFirstBlock = -1;
+    for( ; ; ) {
+        while((block = popMark(&markDeques[worker])) != NULL)
+            markReferents(block);
+        for( i = 1;  i < numGcThreads && block == NULL;  i++ )
+            block = stealMark(&markDeques[(worker + i) % numGcThreads]);
+        if (block != NULL) {
+            markReferents(block);
+            continue;
+        }
+        /* wait until there is something to steal, or all are idle */
+        __atomic_sub_fetch(&markersBusy, 1, __ATOMIC_SEQ_CST);
+        for( ; ; ) {
+            if (__atomic_load_n(&markersBusy, __ATOMIC_SEQ_CST) == 0)
+                return;
+            for( i = 0;  i < numGcThreads;  i++ )
+                if (__atomic_load_n(&markDeques[i].top, __ATOMIC_SEQ_CST)
+                        < __atomic_load_n(&markDeques[i].bottom, __ATOMIC_SEQ_CST))
+                    break;
+            if (i < numGcThreads)
+                break;
+            sched_yield();
+        }
+        __atomic_add_fetch(&markersBusy, 1, __ATOMIC_SEQ_CST);
+    }
+}
 
-    HeapPointer Heap_Iterator = 0;
-    while(Heap_Iterator < MaxHeapPtr) {
-   
-        //printBlock(REAL_HEAP_POINTER(Heap_Iterator));
-        
-        if( !(MARKBIT & *(uint32_t *)REAL_HEAP_POINTER(Heap_Iterator)) ) {
-			// we are not marked, if we were not in the 
-			//  previous freelist we are garbage, so lets 
+/* Marks the roots which are the share of gc thread worker, of
+    numWorkers, and then, in markRoots(), everything reachable in
+    parallel with the other threads.  The first thread scans the C stack, as it is that of the Java program, and, in
+    a minor collection, the dirty cards; the second the JVM stack; and
+    the static fields and string constants of the loaded classes are
+    dealt out among all of them. */
+static void markRootShare( int worker, int numWorkers ) {
+    if (worker == 0) {
+        markAmbiguous(Fake_System_Out);
+        scanCStack();
+        if (collectingNursery)
+            scanDirtyCards(0);
+    }
+    if (worker == 1 % numWorkers)
+        forEachStackReference(markSlot, markAmbiguousSlot);
+    forEachClassRoot(markSlot, worker, numWorkers);
+}
+
+static void markRoots( int worker ) {
+    markRootShare(worker, numGcThreads);
+    drainMarkDeques(worker);
+}
+
+/* Marks every object reachable from the roots, using all the gc threads.
+    If a mark deque overflowed, the heap is then scanned for marked
+    objects, as some of them have not had their referents marked. */
+static void processMarkStack() {
+    LargeObject *lo;
+    HeapOffset hp;
+    uint32_t *block;
+
+    startGcThreads();
+    markersBusy = numGcThreads;
+    runOnGcThreads(markRoots);
+    for( ; ; ) {
+        if (!markStackOverflowed)
+            return;
+        markStackOverflowed = 0;
+        if (tracingExecution & TRACE_HEAP)
+            printf("* mark stack overflow, scanning heap\n");
+        for( hp = 0;  hp < MaxHeapPtr;  hp += *(uint32_t *)HEAP_ADDRESS(hp) ) {
+            uint32_t *sizePtr = HEAP_ADDRESS(hp);
+            if (!isMarked(sizePtr))
+                continue;
+            markReferents(sizePtr + 1);
+            while((block = popMark(&markDeques[0])) != NULL)
+                markReferents(block);
+        }
+        for( lo = nextLargeObject(NULL);  lo != NULL;  lo = nextLargeObject(lo) ) {
+            if (!lo->marked)
+                continue;
+            markReferents((uint32_t*)((uint8_t*)lo + LOSOBJECTOFFSET));
+            while((block = popMark(&markDeques[0])) != NULL)
+                markReferents(block);
+        }
+    }
+}
+
+static void markSlot( HeapPointer *slot ) {
+    if (isProbablePointer(REAL_HEAP_POINTER(*slot)))
+        mark(REAL_HEAP_POINTER(*slot));
+}
+
+/* Marks the objects that the object at block refers to */
+static void markReferents(uint32_t *block) {
+    forEachReference(block, markSlot);
+}
+
+static SatbBuffer *newSatbBuffer() {
+    SatbBuffer *b = satbSpare;
+
+    if (b != NULL)
+        satbSpare = b->next;
+    else
+        b = SafeMalloc(sizeof(SatbBuffer));
+    b->count = 0;
+    return b;
+}
+
+/* Records a reference which the program is about to overwrite */
+void SatbRecord( HeapPointer ref ) {
+    if (ref == NULL_HEAP_REFERENCE)
+        return;
+    if (satbCurrent->count == SATBBUFFERSIZE) {
+        pthread_mutex_lock(&satbLock);
+        satbCurrent->next = satbFull;
+        satbFull = satbCurrent;
+        satbCurrent = newSatbBuffer();
+        pthread_cond_signal(&satbReady);
+        pthread_mutex_unlock(&satbLock);
+    }
+    satbCurrent->refs[satbCurrent->count++] = ref;
+}
+
+/* Marks the references in SATB buffer b and makes it a spare */
+static void markSatbBuffer( SatbBuffer *b ) {
+    int i;
+
+    for( i = 0;  i < b->count;  i++ )
+        markSlot(&b->refs[i]);
+    pthread_mutex_lock(&satbLock);
+    b->next = satbSpare;
+    satbSpare = b;
+    pthread_mutex_unlock(&satbLock);
+}
+
+/* The body of the marking thread, which acts as gc thread 0 until it
+   is stopped */
+static void *concurrentMarker( void *arg ) {
+    SatbBuffer *b;
+    uint32_t *block;
+
+    gcThreadNum = 0;
+    for( ; ; ) {
+        while(!stopMarking && (block = popMark(&markDeques[0])) != NULL)
+            markReferents(block);
+        pthread_mutex_lock(&satbLock);
+        if (satbFull == NULL && !stopMarking) {
+            __atomic_store_n(&markingDone, 1, __ATOMIC_RELEASE);
+            while(satbFull == NULL && !stopMarking)
+                pthread_cond_wait(&satbReady, &satbLock);
+        }
+        b = satbFull;
+        if (b != NULL && !stopMarking)
+            satbFull = b->next;
+        pthread_mutex_unlock(&satbLock);
+        if (stopMarking)
+            return NULL;
+        markSatbBuffer(b);
+    }
+}
+
+/* Starts marking the heap concurrently.  This is called just after a
+   minor collection, so the nursery holds no objects; its runs are put
+   in the free lists.  The roots are marked now, by this thread. */
+static void startConcurrentMark() {
+    int i;
+
+    if (tracingExecution & TRACE_HEAP)
+        printf("* starting concurrent mark\n");
+    concurrentMarkCount++;
+    if (youngLimit - youngPtr >= MINBLOCKSIZE)
+        addToFreeList((uint8_t*)youngPtr - HeapStart);
+    for( i = nextNurseryRun;  i < numNurseryRuns;  i++ )
+        addToFreeList(nurseryRuns[2*i]);
+    beginMarking();
+    markRootShare(0, 1);
+    satbCurrent = newSatbBuffer();
+    stopMarking = markingDone = 0;
+    ConcurrentMarking = 1;
+    markerActive = pthread_create(&markerThread, NULL, concurrentMarker, NULL) == 0;
+    if (!markerActive)
+        markingDone = 1;  /* the remark does it all */
+}
+
+/* Stops the marking thread and completes the marking, with the program
+   stopped, from the references recorded by SATB_BARRIER and the roots */
+static void finishConcurrentMark() {
+    SatbBuffer *b;
+
+    pthread_mutex_lock(&satbLock);
+    stopMarking = 1;
+    pthread_cond_signal(&satbReady);
+    pthread_mutex_unlock(&satbLock);
+    if (markerActive)
+        pthread_join(markerThread, NULL);
+    markerActive = ConcurrentMarking = 0;
+    if (tracingExecution & TRACE_HEAP)
+        printf("* remarking after concurrent mark\n");
+    retireBumpBlock();
+    while((b = satbFull) != NULL) {
+        satbFull = b->next;
+        markSatbBuffer(b);
+    }
+    markSatbBuffer(satbCurrent);
+    satbCurrent = NULL;
+    processMarkStack();
+}
+
+
+/* Frees the run of unmarked blocks from start up to end, as one block.
+   If lists is NULL, carveRange() makes whole pages of it part of the
+   nursery and puts the rest in the free lists; otherwise it goes into
+   lists. */
+static void freeRun( HeapOffset start, HeapOffset end, SweptLists *lists ) {
+    if (lists == NULL) {
+        carveRange(start, end, &nurseryWanted);
+        return;
+    }
+    *(uint32_t *)HEAP_ADDRESS(start) = end - start;
+    MyHeapFree(HEAP_ADDRESS(start + 4), lists);
+}
+
+
+/* Sweeps the blocks from start up to the first block boundary at or
+    after end, and returns that boundary.  Anything that was not marked
+    by the mark function is combined with any free or garbage blocks
+    that follow it, and the combined block is freed by freeRun().
+    The free space in pages chosen for evacuation is not freed, so
+    that evacuate() does not copy objects into it.
+*/
+static HeapOffset sweepRange( HeapOffset start, HeapOffset end, SweptLists *lists ) {
+    HeapOffset runStart = -1;  /* the free block being built, or -1 */
+    long bytesRecovered = 0;
+    int blocksRecovered = 0;
+
+    HeapOffset Heap_Iterator = start;
+    while(Heap_Iterator < end) {
+        uint32_t *sizePtr = HEAP_ADDRESS(Heap_Iterator);
+        uint32_t size = *sizePtr;
+        int evacuating = pageFlags[Heap_Iterator/HEAPPAGESIZE] & PAGE_EVACUATE;
+
+        if( !isMarked(sizePtr) ) {
+			// we are not marked, if we were not in the
+			//  previous freelist we are garbage, so lets
 			//  collect some stats!
-            if (FREELISTBITPATTERN != 
-				*(uint32_t *)REAL_HEAP_POINTER(Heap_Iterator + 8)) {
-				
-                if (tracingExecution & TRACE_HEAP) 
-                    printf("sweep(): Found garbage at %p\n", REAL_HEAP_POINTER(Heap_Iterator)); 
-                
+            if (FREELISTBITPATTERN != sizePtr[1]) {
+
+                if (tracingExecution & TRACE_HEAP)
+                    printf("sweep(): Found garbage at %p\n", HEAP_ADDRESS(Heap_Iterator));
+
                 // Statistics tracking
-                totalBytesRecovered += 
-					*(uint32_t *)REAL_HEAP_POINTER(Heap_Iterator);
-                totalBlocksRecovered++;
+                bytesRecovered += size;
+                blocksRecovered++;
+            }
+            if (evacuating) {
+                clearObjectStarts(Heap_Iterator, Heap_Iterator + size);
+                sizePtr[1] = FREELISTBITPATTERN;
+                if (runStart >= 0)
+                    freeRun(runStart, Heap_Iterator, lists);
+                runStart = -1;
+            } else if (runStart < 0) {
+                runStart = Heap_Iterator;
+            } else {
+                if (tracingExecution & TRACE_HEAP)
+                    fprintf(stdout, "Combining Freelist blocks %p and %p\n",
+                        HEAP_ADDRESS(runStart), sizePtr);
             }
-			MyHeapFree(REAL_HEAP_POINTER(Heap_Iterator + 4));
- 
-        } else { 
-            // Unmark
-            *(uint32_t *)REAL_HEAP_POINTER(Heap_Iterator) &= ~MARKBIT;
+        } else {
+            if (runStart >= 0)
+                freeRun(runStart, Heap_Iterator, lists);
+            runStart = -1;
+        }
+
+        // Move 'size' bytes to next block
+        Heap_Iterator += size;
+    }
+    if (runStart >= 0)
+        freeRun(runStart, Heap_Iterator, lists);
+    if (lists != NULL) {
+        lists->bytesRecovered += bytesRecovered;
+        lists->blocksRecovered += blocksRecovered;
+    } else {
+        totalBytesRecovered += bytesRecovered;
+        totalBlocksRecovered += blocksRecovered;
+    }
+    return Heap_Iterator;
+}
+
+
+/* Returns the offset of the first marked object from lo up to hi, or hi
+   if there is none.  Only the start of an object is ever marked, as a
+   reference from a stack is checked against the object-start bitmap. */
+static HeapOffset firstMark( HeapOffset lo, HeapOffset hi ) {
+    long ix = lo / 4;
+    uint32_t bits;
+
+    while(ix < hi / 4) {
+        bits = markBits[ix >> 3] >> (ix & 7);
+        if (bits == 0) {
+            ix = (ix | 7) + 1;
+            continue;
+        }
+        ix += __builtin_ctz(bits);
+        return ix < hi / 4 ? ix * 4 : hi;
+    }
+    return hi;
+}
+
+
+/* Sweeps the parts of the heap which gc thread worker claims, each
+   into its own lists */
+static void sweepParts( int worker ) {
+    SweptLists *lists;
+    int part, i;
+
+    while((part = __atomic_fetch_add(&nextSweepPart, 1, __ATOMIC_RELAXED))
+            < numSweepParts) {
+        lists = &sweptLists[part];
+        for( i = 0;  i < NUMFREELISTS;  i++ )
+            lists->first[i] = lists->last[i] = -1;
+        lists->bytesRecovered = lists->blocksRecovered = 0;
+        if (sweepPartStart[part] < sweepPartStart[part+1])
+            sweepRange(sweepPartStart[part], sweepPartStart[part+1], lists);
+    }
+}
+
+
+/* Sweep over the whole heap collecting garbage, rebuilding the free
+   lists.  The heap is divided into parts of SWEEPPARTSIZE bytes which
+   the gc threads sweep in parallel.  Each part is swept from the first
+   marked object in it, as the walk from the part before stops there,
+   and its free blocks are put in lists of its own; these are appended
+   to the free lists in address order afterwards. */
+void sweep() {
+    HeapOffset tail[NUMFREELISTS];
+    int part, ix;
+    SweptLists *lists;
+
+	// we rebuild the free lists at each gc, so reset them!
+    clearFreeLists();
+    sweepPartStart[numSweepParts] = MaxHeapPtr;
+    for( part = numSweepParts - 1;  part > 0;  part-- ) {
+        HeapOffset lo = (long)part * SWEEPPARTSIZE;
+        HeapOffset hi = lo + SWEEPPARTSIZE < MaxHeapPtr ? lo + SWEEPPARTSIZE : MaxHeapPtr;
+        sweepPartStart[part] = firstMark(lo, hi);
+        if (sweepPartStart[part] == hi)  /* the part before covers it all */
+            sweepPartStart[part] = sweepPartStart[part+1];
+    }
+    sweepPartStart[0] = 0;
+    nextSweepPart = 0;
+    runOnGcThreads(sweepParts);
+
+    for( part = 0;  part < numSweepParts;  part++ ) {
+        lists = &sweptLists[part];
+        totalBytesRecovered += lists->bytesRecovered;
+        totalBlocksRecovered += lists->blocksRecovered;
+        for( ix = 0;  ix < NUMFREELISTS;  ix++ ) {
+            if (lists->first[ix] < 0)
+                continue;
+            if (freeLists[ix] < 0)
+                freeLists[ix] = lists->first[ix];
+            else
+                ((FreeStorageBlock*)HEAP_ADDRESS(tail[ix]))->offsetToNextBlock =
+                    lists->first[ix];
+            tail[ix] = lists->last[ix];
+            nonEmptyLists |= (uint64_t)1 << ix;
         }
+    }
+}
+
+
+/* Sweeps the next chunk of the heap left unswept by gc(), returning 0
+   if there was none */
+static int sweepChunk() {
+    HeapOffset from, to;
+
+    lockHeap();
+    from = sweepPtr;
+    to = sweepEnd - from > SWEEPCHUNKSIZE ? from + SWEEPCHUNKSIZE : sweepEnd;
+    if (from < sweepEnd) {
+        sweepPtr = sweepRange(from, to, NULL);
+        if (sweepPtr >= sweepEnd)
+            uncommitFreePages();
+    }
+    unlockHeap();
+    if (from >= sweepEnd)
+        return 0;
+    if (tracingExecution & TRACE_HEAP)
+        printf("* swept heap from %ld to %ld\n", from, sweepPtr);
+    return 1;
+}
+
+
+/* The body of the background sweeping thread */
+static void *sweeper( void *arg ) {
+    while(sweepChunk())
+        ;
+    return NULL;
+}
+
+
+/* Starts sweeping the heap after marking, when no pages are to be
+   evacuated.  The free lists and the nursery are rebuilt as the chunks
+   are swept, and the nursery is to hold 1/NURSERYFRACTION of the heap,
+   or a quarter of the space not found live if that is less. */
+static void startSweep() {
+    long live = 0;
+    int i;
+
+    clearFreeLists();
+    for( i = 0;  i < numHeapPages;  i++ )
+        live += pageLive[i];
+    nurseryWanted = numHeapPages / NURSERYFRACTION;
+    if (nurseryWanted > (MaxHeapPtr - live) / HEAPPAGESIZE / 4)
+        nurseryWanted = (MaxHeapPtr - live) / HEAPPAGESIZE / 4;
+    sweepPtr = 0;
+    sweepEnd = MaxHeapPtr;
+    if (SweepMode == SWEEP_BACKGROUND) {
+        sweeperActive = 1;
+        if (pthread_create(&sweeperThread, NULL, sweeper, NULL) != 0)
+            sweeperActive = 0;  /* MyHeapAlloc does it all */
+    }
+}
+
 
-        // Move 'size' bytes to next block (ignoring the Mark Bit when determining size)
-        Heap_Iterator += ~MARKBIT & *(uint32_t *)REAL_HEAP_POINTER(Heap_Iterator);
+/* Completes the sweep begun by the last gc(), if there is one, as must
+   be done before the mark bits are used again */
+static void finishSweep() {
+    if (sweeperActive) {
+        pthread_join(sweeperThread, NULL);
+        sweeperActive = 0;
     }
-	//printHeap();
+    while(sweepChunk())
+        ;
+}
+
+
+static long bytesInUse;
+
+static void countBytesInUse( void *obj ) {
+    bytesInUse += ((uint32_t*)obj)[-1];
+}
+
+
+/* Returns the number of bytes of the heap and the large object space
+   which are resident, as reported by mincore; the metaspace between
+   them is not counted */
+static long committedBytes() {
+    long numPages = (LosStart - HeapStart) / osPageSize + losPagesUsed, i, count = 0;
+    long metaFirst = (MetaspaceStart - HeapStart) / osPageSize;
+    long metaLast = (LosStart - HeapStart) / osPageSize;
+    unsigned char *vec = SafeMalloc(numPages);
+
+    if (mincore(HeapStart, numPages * osPageSize, vec) == 0) {
+        for( i = 0;  i < numPages;  i++ )
+            if (i < metaFirst || i >= metaLast)
+                count += vec[i] & 1;
+    }
+    SafeFree(vec);
+    return count * osPageSize;
 }
 
 
 /* Report on heap memory usage */
 void PrintHeapUsageStatistics() {
+    ClassType *ct;
+    int numClasses = 0;
+
+    finishSweep();
+    bytesInUse = 0;
+    ForEachHeapObject(countBytesInUse);
     printf("\nHeap Usage Statistics\n=====================\n\n");
     printf("  Number of blocks allocated = %d\n", numAllocations);
     if (numAllocations > 0) {
@@ -592,14 +2769,37 @@ void PrintHeapUsageStatistics() {
         printf("  Total storage reclaimed = %ld\n", totalBytesRecovered);
         printf("  Total number of blocks reclaimed = %d\n", totalBlocksRecovered);
         printf("  Average bytes recovered per gc = %.2f\n", avgRecovery);
+        printf("  Number of objects evacuated = %ld (%ld bytes)\n",
+            objectsEvacuated, bytesEvacuated);
+        printf("  Average number of pages pinned per gc = %.2f of %d\n",
+            (float)totalPagesPinned / gcCount, numHeapPages);
     }
+    if (concurrentMarkCount > 0)
+        printf("  Number of concurrent marks = %d\n", concurrentMarkCount);
+    printf("  Heap size = %ld bytes (initially %ld, at most %ld; resized %d times)\n",
+        MaxHeapPtr, initialHeapSize, MaxHeapSize, heapResizes);
+    printf("  Heap committed = %ld bytes, in use = %ld bytes (%ld returned to the OS)\n",
+        committedBytes(), bytesInUse, bytesUncommitted);
+    for( ct = FirstLoadedClass;  ct != NULL;  ct = ct->nextClass )
+        numClasses++;
+    printf("  Metaspace used = %ld bytes, by %d classes\n",
+        (long)(MetaspaceTop - MetaspaceStart), numClasses);
+    if (largeObjectsAllocated > 0)
+        printf("  Number of large objects allocated = %d (%d freed)\n",
+            largeObjectsAllocated, largeObjectsFreed);
+    printf("  Number of minor collections = %d\n", minorGcCount);
+    if (minorGcCount > 0)
+        printf("  Number of objects promoted = %ld (%ld bytes)\n",
+            objectsPromoted, bytesPromoted);
 }
 
 static void *trackHeapArea( void *p ) {
+    pthread_mutex_lock(&addrLock);
     if (p > maxAddr)
         maxAddr = p;
-    if (p < minAddr)
+    if (p < minAddr || minAddr == NULL)
         minAddr = p;
+    pthread_mutex_unlock(&addrLock);
     return p;
 }
 
@@ -660,3 +2860,77 @@ void SafeFree( void *p ) {
         abort();
     }
 }
+
+
+/* An arena hands out storage from large chunks obtained with SafeMalloc.
+   Its storage is never freed piecemeal; FreeArena releases all of it.
+   An arena must only be used by one thread at a time. */
+
+typedef struct ArenaChunk {
+    struct ArenaChunk *next;    /* the chunk filled before this one */
+    int size;                   /* bytes available in data */
+    int used;
+    uint8_t data[];
+} ArenaChunk;
+
+struct Arena {
+    ArenaChunk *chunks;         /* the chunk being filled, first */
+    int chunkSize;
+};
+
+#define ARENAALIGN 8
+
+
+static ArenaChunk *addChunk( Arena *a, int size ) {
+    ArenaChunk *c = SafeMalloc(sizeof(ArenaChunk) + size);
+    c->size = size;
+    c->used = 0;
+    c->next = a->chunks;
+    a->chunks = c;
+    return c;
+}
+
+
+/* Creates an arena whose storage comes in chunks of chunkSize bytes */
+Arena *NewArena( int chunkSize ) {
+    Arena *a = SafeMalloc(sizeof(Arena));
+    a->chunkSize = (chunkSize + ARENAALIGN - 1) & ~(ARENAALIGN - 1);
+    a->chunks = NULL;
+    addChunk(a, a->chunkSize);
+    return a;
+}
+
+
+/* Returns size bytes of zeroed storage from the arena */
+void *ArenaAlloc( Arena *a, int size ) {
+    ArenaChunk *c = a->chunks;
+    void *result;
+
+    size = (size + ARENAALIGN - 1) & ~(ARENAALIGN - 1);
+    if (c->used + size > c->size) {
+        if (size > a->chunkSize / 2) {
+            // a big request gets a chunk to itself, behind the current one
+            ArenaChunk *big = SafeMalloc(sizeof(ArenaChunk) + size);
+            big->size = big->used = size;
+            big->next = c->next;
+            c->next = big;
+            return big->data;
+        }
+        c = addChunk(a, a->chunkSize);
+    }
+    result = c->data + c->used;
+    c->used += size;
+    return result;
+}
+
+
+/* Releases all the storage of the arena, and the arena itself */
+void FreeArena( Arena *a ) {
+    ArenaChunk *c, *next;
+
+    for( c = a->chunks;  c != NULL;  c = next ) {
+        next = c->next;
+        SafeFree(c);
+    }
+    SafeFree(a);
+}
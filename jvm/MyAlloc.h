@@ -12,16 +12,77 @@
 /* All pointers into the JVM Heap are implemented as
    offsets from the base of the heap area.
    This allows us to use 4 bytes for a heap pointer,
-   even on a machine with 64-bit words.  */
+   even on a machine with 64-bit words.  The offsets
+   held in references may be scaled; see jvm.h. */
 typedef uint32_t HeapPointer;
 
 extern uint8_t *HeapStart, *HeapEnd;
-extern HeapPointer MaxHeapPtr;
+extern long MaxHeapPtr;     /* the size of the heap in use, HeapEnd - HeapStart */
+
+/* The heap grows in place, up to this size, as set by -Xmx; it may be
+   more than 4GB, so sizes and offsets within it are longs */
+extern long MaxHeapSize;
+
+/* Large objects are allocated outside the heap, in the large object
+   space, which is reserved just after it so that they can be referred
+   to by HeapPointer offsets as well.  At least MINLOSSIZE bytes of
+   address space are reserved for it. */
+extern uint8_t *LosStart, *LosEnd;
+#define MINLOSSIZE (256*1024*1024)
+
+/* The classes are allocated in the metaspace, which is reserved between
+   the heap and the large object space, outside the Java heap; they are
+   never moved or freed, and their static fields are roots */
+extern uint8_t *MetaspaceStart, *MetaspaceTop;
+#define METASPACESIZE (16*1024*1024)  /* the address space reserved for it */
+
+/* Card marking.  Whenever a reference is stored into an object in the
+   heap, WRITE_BARRIER must be applied to the object so that a minor
+   collection can find the references from old objects to young ones. */
+#define CARDSIZE 512
+extern uint8_t *CardTable;
+/* The large object space has cards of its own, in LosCardTable; each
+   large object is at the start of a page, and so has a card to itself.
+   They are bigger, as only the card of the page holding the object's
+   header is ever marked. */
+#define LOSCARDSIZE 4096
+extern uint8_t *LosCardTable;
+#define WRITE_BARRIER(obj) \
+    do { if ((uint8_t*)(obj) < LosStart) \
+            CardTable[((uint8_t*)(obj) - HeapStart) / CARDSIZE] = 1; \
+        else \
+            LosCardTable[((uint8_t*)(obj) - LosStart) / LOSCARDSIZE] = 1; \
+    } while(0)
+
+/* Snapshot-at-the-beginning barrier.  While the heap is being marked
+   concurrently, the reference in the field at slot must be recorded by
+   SATB_BARRIER before it is overwritten, so that everything reachable
+   when marking began is marked. */
+extern int ConcurrentMark;      /* set by -Xmark:concurrent */
+extern int ConcurrentMarking;   /* set while the marking thread runs */
+extern void SatbRecord( HeapPointer ref );
+#define SATB_BARRIER(slot) \
+    do { if (ConcurrentMarking) SatbRecord(*(HeapPointer*)(slot)); } while(0)
+
+/* How gc() sweeps the heap, as chosen by the -Xsweep option */
+#define SWEEP_EAGER      0  /* all of it, before gc() returns */
+#define SWEEP_LAZY       1  /* a chunk at a time, as MyHeapAlloc needs space */
+#define SWEEP_BACKGROUND 2  /* lazily, and by a thread which gc() starts */
+extern int SweepMode;
+
+/* The number of threads which mark and sweep the heap in a collection */
+extern int ParallelGCThreads;
 
 extern void InitMyAlloc( int HeapSize );
 extern void *MyHeapAlloc( int size );
 extern void gc();
 extern void PrintHeapUsageStatistics();
+extern uint8_t *ReserveHeap( long heapSize );
+extern void AdoptHeap( uint8_t *heap, long heapSize );
+extern void *AdoptLargeObject( HeapPointer ref, uint32_t size );
+extern void *MetaspaceAlloc( int size );
+extern void *AdoptMetaspace( long size );
+extern void ForEachHeapObject( void (*visit)(void *obj) );
 int isProbablePointer(void *real_heap_pointer);
 void mark();
 void sweep();
@@ -32,4 +93,9 @@ extern void *SafeMalloc( int size );
 extern void *SafeCalloc( int ncopies, int size );
 extern void SafeFree( void *p );
 
+typedef struct Arena Arena;
+extern Arena *NewArena( int chunkSize );
+extern void *ArenaAlloc( Arena *a, int size );
+extern void FreeArena( Arena *a );
+
 #endif
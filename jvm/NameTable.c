@@ -0,0 +1,86 @@
+/* NameTable.c */
+
+/*
+   A chained hash table with string keys.
+
+   The lookup functions are:
+   * NameTableLookup  -- returns the entry for a name, or NULL
+   * NameTableInsert  -- returns the entry for a name, creating it if
+                         necessary (with a NULL value)
+
+   The number of buckets doubles whenever the number of entries exceeds
+   it, so the chains stay short and lookups take constant time on average.
+   Entries are never removed.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "MyAlloc.h"
+#include "NameTable.h"
+
+#define INITIALBUCKETS 64
+
+
+/* the FNV-1a hash function */
+unsigned int HashName( char *name ) {
+    unsigned int h = 2166136261u;
+    while(*name != '\0') {
+        h ^= (unsigned char)*name++;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+
+static void growTable( NameTable *t ) {
+    int newSize = (t->numBuckets == 0)? INITIALBUCKETS : 2*t->numBuckets;
+    NameEntry **newBuckets = SafeCalloc(newSize, sizeof(NameEntry*));
+    int i;
+
+    for( i = 0;  i < t->numBuckets;  i++ ) {
+        NameEntry *e = t->buckets[i];
+        while(e != NULL) {
+            NameEntry *next = e->next;
+            int b = HashName(e->name) & (newSize-1);
+            e->next = newBuckets[b];
+            newBuckets[b] = e;
+            e = next;
+        }
+    }
+    if (t->buckets != NULL)
+        SafeFree(t->buckets);
+    t->buckets = newBuckets;
+    t->numBuckets = newSize;
+}
+
+
+NameEntry *NameTableLookup( NameTable *t, char *name ) {
+    NameEntry *e;
+    if (t->buckets == NULL)
+        return NULL;
+    for( e = t->buckets[HashName(name) & (t->numBuckets-1)];  e != NULL;  e = e->next ) {
+        if (strcmp(e->name, name) == 0)
+            return e;
+    }
+    return NULL;
+}
+
+
+NameEntry *NameTableInsert( NameTable *t, char *name ) {
+    NameEntry *e = NameTableLookup(t, name);
+    int b;
+
+    if (e != NULL)
+        return e;
+    if (t->numEntries >= t->numBuckets)
+        growTable(t);
+    e = SafeMalloc(sizeof(NameEntry));
+    e->name = SafeStrdup(name);
+    b = HashName(name) & (t->numBuckets-1);
+    e->next = t->buckets[b];
+    t->buckets[b] = e;
+    t->numEntries++;
+    return e;
+}
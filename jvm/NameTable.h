@@ -0,0 +1,27 @@
+/* NameTable.h */
+
+#ifndef NAMETABLEH
+
+#define NAMETABLEH
+
+/* A NameTable is a hash table whose keys are strings.  Each entry
+   carries one pointer-sized value for the use of the table's owner.
+   A table whose buckets field is NULL is empty, so a zero-initialized
+   NameTable is ready for use. */
+typedef struct NameEntry {
+    char *name;                 /* the key, a private copy */
+    void *value;                /* owner's data, initially NULL */
+    struct NameEntry *next;     /* next entry in the same bucket */
+} NameEntry;
+
+typedef struct {
+    int numBuckets;
+    int numEntries;
+    NameEntry **buckets;
+} NameTable;
+
+extern unsigned int HashName( char *name );
+extern NameEntry *NameTableLookup( NameTable *t, char *name );
+extern NameEntry *NameTableInsert( NameTable *t, char *name );
+
+#endif
@@ -24,6 +24,9 @@
       java/lang/String
           charAt(int)
           length()
+          intern()
+      with the strings themselves created by NewString and read back by
+      StringToUTF8, and the canonical ones kept by InternString
           
       StringBuilder methods are passed on to StringBuilder.c for handling
 
@@ -31,6 +34,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <string.h>
 #include <assert.h>
 #include <stdint.h>
@@ -52,7 +56,10 @@ void MissingClassVirtualMethod( char *className, char *methodName, char *methodD
                 if (hp == NULL_HEAP_REFERENCE)
                     throwExceptionExternal("NullPointerException", methodName, className);
                 StringInstance *arg = REAL_HEAP_POINTER(hp);
-                printf("%s",arg->sval);
+                int len;
+                char *s = StringToUTF8(arg, &len);
+                fwrite(s, 1, len, stdout);
+                SafeFree(s);
             } else if (strcmp(methodDescr,"(I)V") == 0) {
                 int i = JVM_Pop();
                 printf("%d",i);
@@ -89,11 +96,10 @@ void MissingClassVirtualMethod( char *className, char *methodName, char *methodD
                 if (hp == NULL_HEAP_REFERENCE)
                     throwExceptionExternal("NullPointerException", methodName, className);
                 StringInstance *sp = REAL_HEAP_POINTER(hp);
-                char *s = sp->sval;
-                if (ix < 0 || ix >= strlen(s))
+                if (ix < 0 || ix >= sp->length)
                     throwExceptionExternal("StringIndexOutOfBoundsException",
                         methodName, className);
-                JVM_Push(s[ix]);
+                JVM_Push(STRING_CHAR(sp, ix));
                 return;
             }
         }
@@ -103,7 +109,16 @@ void MissingClassVirtualMethod( char *className, char *methodName, char *methodD
                 if (hp == NULL_HEAP_REFERENCE)
                     throwExceptionExternal("NullPointerException", methodName, className);
                 StringInstance *sp = REAL_HEAP_POINTER(hp);
-                JVM_Push(strlen(sp->sval));
+                JVM_Push(sp->length);
+                return;
+            }
+        }
+        if (strcmp(methodName,"intern") == 0) {
+            if (strcmp(methodDescr,"()Ljava/lang/String;") == 0) {
+                HeapPointer hp = JVM_Pop();
+                if (hp == NULL_HEAP_REFERENCE)
+                    throwExceptionExternal("NullPointerException", methodName, className);
+                JVM_Push(MAKE_HEAP_REFERENCE(InternString(REAL_HEAP_POINTER(hp))));
                 return;
             }
         }
@@ -150,8 +165,10 @@ void MissingClassStaticMethod( char *className, char *methodName, char *methodDe
                 HeapPointer hp = JVM_Pop();
                 if (hp == NULL_HEAP_REFERENCE)
                     throwExceptionExternal("NullPointerException", methodName, className);
-                StringInstance *arg = REAL_HEAP_POINTER(hp);
-                if (sscanf(arg->sval, "%d", &ival) < 1)
+                char *s = StringToUTF8(REAL_HEAP_POINTER(hp), NULL);
+                int ok = sscanf(s, "%d", &ival) == 1;
+                SafeFree(s);
+                if (!ok)
                     throwExceptionExternal( "NumberFormatException", methodName, className );
                 JVM_Push( (uint32_t)ival );
                 return;
@@ -164,8 +181,10 @@ void MissingClassStaticMethod( char *className, char *methodName, char *methodDe
                 HeapPointer hp = JVM_Pop();
                 if (hp == NULL_HEAP_REFERENCE)
                     throwExceptionExternal("NullPointerException", methodName, className);
-                StringInstance *arg = REAL_HEAP_POINTER(hp);
-                if (sscanf(arg->sval, "%lg", &pair.dval) < 1)
+                char *s = StringToUTF8(REAL_HEAP_POINTER(hp), NULL);
+                int ok = sscanf(s, "%lg", &pair.dval) == 1;
+                SafeFree(s);
+                if (!ok)
                     throwExceptionExternal( "NumberFormatException", methodName, className );
                 JVM_Push(pair.uval[0]);
                 JVM_Push(pair.uval[1]);
@@ -180,8 +199,10 @@ void MissingClassStaticMethod( char *className, char *methodName, char *methodDe
                 HeapPointer hp = JVM_Pop();
                 if (hp == NULL_HEAP_REFERENCE)
                     throwExceptionExternal("NullPointerException", methodName, className);
-                StringInstance *arg = REAL_HEAP_POINTER(hp);
-                if (sscanf(arg->sval, "%f", &fval) < 1)
+                char *s = StringToUTF8(REAL_HEAP_POINTER(hp), NULL);
+                int ok = sscanf(s, "%f", &fval) == 1;
+                SafeFree(s);
+                if (!ok)
                     throwExceptionExternal( "NumberFormatException", methodName, className );
                 JVM_PushFloat(fval);
                 return;
@@ -193,3 +214,224 @@ void MissingClassStaticMethod( char *className, char *methodName, char *methodDe
     exit(1);
 }
 
+
+
+/* Decodes the character at *pp, in UTF-8 or the modified UTF-8 of class
+   files, and advances *pp past it.  A byte which does not start a valid
+   sequence before end is taken to be a Latin-1 character. */
+static int nextCodePoint( uint8_t **pp, uint8_t *end ) {
+    uint8_t *p = *pp;
+    int c = *p++, n = 0, i;
+
+    if (c >= 0xC0 && c < 0xE0) {
+        n = 1;  c &= 0x1F;
+    } else if (c >= 0xE0 && c < 0xF0) {
+        n = 2;  c &= 0x0F;
+    } else if (c >= 0xF0 && c < 0xF8) {
+        n = 3;  c &= 0x07;
+    }
+    if (p + n > end)
+        n = -1;
+    for( i = 0;  i < n;  i++ ) {
+        if ((p[i] & 0xC0) != 0x80)
+            break;
+        c = (c << 6) | (p[i] & 0x3F);
+    }
+    if (i != n) {
+        *pp += 1;
+        return p[-1];
+    }
+    *pp = p + n;
+    return c;
+}
+
+
+/* Allocates a String on the heap holding the characters encoded in the
+   numBytes bytes at s, in UTF-8 or modified UTF-8.  They are stored one
+   byte each if they are all Latin-1, and as UTF-16 otherwise. */
+StringInstance *NewString( char *s, int numBytes ) {
+    uint8_t *p, *end = (uint8_t*)s + numBytes;
+    int length = 0, maxChar = 0, coder, c, i;
+    StringInstance *sp;
+
+    for( p = (uint8_t*)s;  p < end;  ) {
+        c = nextCodePoint(&p, end);
+        length += (c > 0xFFFF)? 2 : 1;
+        if (c > maxChar)
+            maxChar = c;
+    }
+    coder = (maxChar < 256)? STRING_LATIN1 : STRING_UTF16;
+    sp = MyHeapAlloc(offsetof(StringInstance, chars) + (length << coder));
+    sp->kind = CODE_STRG;
+    sp->length = length;
+    sp->coder = coder;
+    for( p = (uint8_t*)s, i = 0;  p < end;  ) {
+        c = nextCodePoint(&p, end);
+        if (coder == STRING_LATIN1) {
+            sp->chars.latin1[i++] = c;
+        } else if (c > 0xFFFF) {  /* a surrogate pair */
+            c -= 0x10000;
+            sp->chars.utf16[i++] = 0xD800 + (c >> 10);
+            sp->chars.utf16[i++] = 0xDC00 + (c & 0x3FF);
+        } else
+            sp->chars.utf16[i++] = c;
+    }
+    return sp;
+}
+
+
+/* Encodes the characters of the String sp in UTF-8 at buf, if it is not
+   NULL, and returns the number of bytes */
+static int encodeUTF8( StringInstance *sp, uint8_t *buf ) {
+    int i, c, n = 0;
+
+    for( i = 0;  i < sp->length;  i++ ) {
+        c = STRING_CHAR(sp, i);
+        if (c >= 0xD800 && c < 0xDC00 && i+1 < sp->length
+                && STRING_CHAR(sp, i+1) >= 0xDC00 && STRING_CHAR(sp, i+1) < 0xE000) {
+            c = 0x10000 + ((c - 0xD800) << 10) + (STRING_CHAR(sp, i+1) - 0xDC00);
+            i++;
+        }
+        if (c < 0x80) {
+            if (buf != NULL) buf[n] = c;
+            n += 1;
+        } else if (c < 0x800) {
+            if (buf != NULL) {
+                buf[n] = 0xC0 | (c >> 6);
+                buf[n+1] = 0x80 | (c & 0x3F);
+            }
+            n += 2;
+        } else if (c < 0x10000) {
+            if (buf != NULL) {
+                buf[n] = 0xE0 | (c >> 12);
+                buf[n+1] = 0x80 | ((c >> 6) & 0x3F);
+                buf[n+2] = 0x80 | (c & 0x3F);
+            }
+            n += 3;
+        } else {
+            if (buf != NULL) {
+                buf[n] = 0xF0 | (c >> 18);
+                buf[n+1] = 0x80 | ((c >> 12) & 0x3F);
+                buf[n+2] = 0x80 | ((c >> 6) & 0x3F);
+                buf[n+3] = 0x80 | (c & 0x3F);
+            }
+            n += 4;
+        }
+    }
+    return n;
+}
+
+
+/* Returns the characters of the String sp in UTF-8, terminated by a
+   null byte, in storage which the caller must free with SafeFree.  If
+   numBytes is not NULL, the number of bytes is stored there. */
+char *StringToUTF8( StringInstance *sp, int *numBytes ) {
+    int n = encodeUTF8(sp, NULL);
+    char *s = SafeMalloc(n + 1);
+
+    encodeUTF8(sp, (uint8_t*)s);
+    s[n] = '\0';
+    if (numBytes != NULL)
+        *numBytes = n;
+    return s;
+}
+
+
+/* The interned strings are kept in an open hash table of references,
+   which grows to stay at most half full; an empty entry holds
+   NULL_HEAP_REFERENCE.  The entries are weak: the garbage collector
+   removes those for strings which it did not mark, in
+   PruneInternedStrings, and updates the rest when the strings move.
+   A string is hashed on its characters, so it stays in place when it
+   moves. */
+static HeapPointer *internTable = NULL;
+static int internTableSize = 0, numInterned = 0;
+
+static uint32_t hashString( StringInstance *sp ) {
+    uint32_t h = 2166136261u;  /* FNV-1a */
+    int i, n = sp->length << sp->coder;
+
+    for( i = 0;  i < n;  i++ )
+        h = (h ^ sp->chars.latin1[i]) * 16777619u;
+    return h;
+}
+
+
+/* Returns the entry of the intern table which holds a string equal to
+   sp, or else the empty entry where it belongs */
+static HeapPointer *findInterned( StringInstance *sp ) {
+    uint32_t i = hashString(sp) & (internTableSize - 1);
+    StringInstance *s;
+
+    for( ; ;  i = (i + 1) & (internTableSize - 1) ) {
+        if (internTable[i] == NULL_HEAP_REFERENCE)
+            return &internTable[i];
+        s = REAL_HEAP_POINTER(internTable[i]);
+        if (s->length == sp->length && s->coder == sp->coder
+                && memcmp(s->chars.latin1, sp->chars.latin1, sp->length << sp->coder) == 0)
+            return &internTable[i];
+    }
+}
+
+
+static void growInternTable() {
+    HeapPointer *old = internTable;
+    int i, oldSize = internTableSize;
+
+    internTableSize = (oldSize == 0)? 256 : 2*oldSize;
+    internTable = SafeCalloc(internTableSize, sizeof(HeapPointer));
+    for( i = 0;  i < oldSize;  i++ )
+        if (old[i] != NULL_HEAP_REFERENCE)
+            *findInterned(REAL_HEAP_POINTER(old[i])) = old[i];
+    if (old != NULL)
+        SafeFree(old);
+}
+
+
+/* Returns the canonical String equal to sp, which is sp itself if no
+   equal string has been interned before */
+StringInstance *InternString( StringInstance *sp ) {
+    HeapPointer *entry;
+
+    if (2*(numInterned + 1) > internTableSize)
+        growInternTable();
+    entry = findInterned(sp);
+    if (*entry == NULL_HEAP_REFERENCE) {
+        *entry = MAKE_HEAP_REFERENCE(sp);
+        numInterned++;
+    } else {
+        /* the marker may not have reached it by a strong reference */
+        SATB_BARRIER(entry);
+    }
+    return REAL_HEAP_POINTER(*entry);
+}
+
+
+/* Removes the entries of the intern table for which isLive returns 0,
+   and rehashes the rest, as removing entries would break the chains
+   of those which collided with them */
+void PruneInternedStrings( int (*isLive)(HeapPointer ref) ) {
+    HeapPointer *old = internTable;
+    int i;
+
+    if (old == NULL)
+        return;
+    internTable = SafeCalloc(internTableSize, sizeof(HeapPointer));
+    numInterned = 0;
+    for( i = 0;  i < internTableSize;  i++ )
+        if (old[i] != NULL_HEAP_REFERENCE && isLive(old[i])) {
+            *findInterned(REAL_HEAP_POINTER(old[i])) = old[i];
+            numInterned++;
+        }
+    SafeFree(old);
+}
+
+
+/* Calls visit for each entry of the intern table which holds a string */
+void ForEachInternedString( void (*visit)(HeapPointer *slot) ) {
+    int i;
+
+    for( i = 0;  i < internTableSize;  i++ )
+        if (internTable[i] != NULL_HEAP_REFERENCE)
+            visit(&internTable[i]);
+}
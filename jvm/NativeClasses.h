@@ -4,7 +4,14 @@
 
 #define NATIVECLASSESH
 
+#include "jvm.h"  /* to define StringInstance type */
+
 extern void MissingClassVirtualMethod( char *className, char *methodName, char *methodDescr );
 extern void MissingClassStaticMethod( char *className, char *methodName, char *methodDescr );
+extern StringInstance *NewString( char *s, int numBytes );
+extern char *StringToUTF8( StringInstance *sp, int *numBytes );
+extern StringInstance *InternString( StringInstance *sp );
+extern void ForEachInternedString( void (*visit)(HeapPointer *slot) );
+extern void PruneInternedStrings( int (*isLive)(HeapPointer ref) );
 
 #endif
@@ -13,6 +13,7 @@
 #include <stdint.h>
 
 #include "ClassFileFormat.h"
+#include "ReadClassFile.h"
 #include "MyAlloc.h"
 #include "PrintClassFile.h"
 #include "PrintByteCode.h"
@@ -102,6 +103,8 @@ void PrintConstantPool( ClassFile *cf ) {
 void PrintMethod( ClassFile *cf, int ix ) {
     method_info *m = &(cf->methods[ix]);
     char *s = GetCPItemAsString(cf, m->name_index);
+    if (m->body != NULL)
+        MaterializeMethod(cf, m);
     printf("\n   Method %s\n", s);
     SafeFree(s);
     s = GetCPItemAsString(cf, m->descriptor_index);
@@ -2,10 +2,29 @@
 
 /*
    Reads a class from a file, building a representation in memory as an
-   instance of the ClassFile struct.
+   instance of the ClassFile struct.  The file is found by searching the
+   class path (see ClassPath.c), unless a parsed copy is available in
+   the shared class archive (see ClassArchive.c).  The classes that a
+   newly read class refers to are handed to the prefetch threads (see
+   ClassPrefetch.c), which may then have read them by the time they are
+   needed.
 
    Attributes other than those explicitly needed by the MyJVM program
    are ignored.
+
+   The whole class file is brought into memory (mapped, if it is a
+   file) and parsed from there.  Method bodies are not parsed with the
+   rest of the class: ReadMethods only records where each Code attribute
+   is, and MaterializeMethod fills in the code, exception table and
+   attributes, and verifies the method, when the method is first used.
+   The method's code is left in the class file image rather than being
+   copied, so pages holding methods that are never run are never touched.
+
+   Everything else that is built for a class -- the ClassFile struct, the
+   constant pool, the field and method tables and the UTF8 strings -- is
+   allocated from an arena belonging to the class.  The pieces are laid
+   out one after another in the order they are read, and FreeClassFile
+   releases them all at once.
 */
 
 #include <stdlib.h>
@@ -14,9 +33,17 @@
 #include <string.h>
 #include <assert.h>
 #include <stdint.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
 
 #include "ClassFileFormat.h"
 #include "ReadClassFile.h"
+#include "ClassPath.h"
+#include "ClassPrefetch.h"
+#include "ClassArchive.h"
+#include "NameTable.h"
+#include "Verifier.h"
+#include "StartupStats.h"
 #include "MyAlloc.h"
 
 
@@ -26,7 +53,14 @@ typedef struct FileNameListItem {
         struct FileNameListItem *next;
     } *FileNameList;
 
+/* The position reached in the in-memory copy of a class file */
+typedef struct {
+    uint8_t *next;      /* next byte to be read */
+    uint8_t *end;       /* just past the last byte */
+} ClassBytes;
+
 static FileNameList filesRead = NULL;  // list of class files we tried to read
+static NameTable filesReadTable;       // the same list, indexed by file name
 
 
 void PrintFilesRead() {
@@ -42,25 +76,36 @@ void PrintFilesRead() {
 }
 
 
-static uint32_t ReadU4(FILE *f) {
+// A truncated class file reads as though padded with zeros
+static uint8_t ReadU1(ClassBytes *f) {
+    return (f->next < f->end)? *f->next++ : 0;
+}
+
+
+static uint32_t ReadU4(ClassBytes *f) {
     uint32_t r = 0;
-    r = fgetc(f) & 0xff;
-    r = (r << 8) | (fgetc(f) & 0xff);
-    r = (r << 8) | (fgetc(f) & 0xff);
-    r = (r << 8) | (fgetc(f) & 0xff);
+    r = ReadU1(f);
+    r = (r << 8) | ReadU1(f);
+    r = (r << 8) | ReadU1(f);
+    r = (r << 8) | ReadU1(f);
     return r;
 }
 
 
-static uint16_t ReadU2(FILE *f) {
+static uint16_t ReadU2(ClassBytes *f) {
     uint16_t r = 0;
-    r = fgetc(f) & 0xff;
-    r = (r << 8) | (fgetc(f) & 0xff);
+    r = ReadU1(f);
+    r = (r << 8) | ReadU1(f);
     return r;
 }
 
 
-static void ReadConstantPool(FILE *f, ClassFile *cf) {\
+static void SkipBytes(ClassBytes *f, uint32_t len) {
+    f->next = (len < f->end - f->next)? f->next + len : f->end;
+}
+
+
+static void ReadConstantPool(ClassBytes *f, ClassFile *cf) {
     uint16_t cnt;
     int i;
     ConstantPoolTag t;
@@ -68,10 +113,10 @@ static void ReadConstantPool(FILE *f, ClassFile *cf) {\
     int len;
 
     cf->constant_pool_count = cnt = ReadU2(f);
-    cf->cp_tag = SafeCalloc(cnt,sizeof(uint8_t));
-    cf->cp_item = SafeCalloc(cnt,sizeof(ConstantPoolItem));
+    cf->cp_tag = ArenaAlloc(cf->arena, cnt*sizeof(uint8_t));
+    cf->cp_item = ArenaAlloc(cf->arena, cnt*sizeof(ConstantPoolItem));
     for( i=1; i<cnt; i++ ) {
-        t = (ConstantPoolTag)fgetc(f);
+        t = (ConstantPoolTag)ReadU1(f);
         cf->cp_tag[i] = (uint8_t)t;
         switch(t) {
         case CP_UTF8:
@@ -79,11 +124,11 @@ static void ReadConstantPool(FILE *f, ClassFile *cf) {\
             // We allocate an extra null byte at end of the string.
             // This allows most UTF8 strings to be treated as regular
             // ASCII strings in C.
-            cf->cp_item[i].sval = s = SafeMalloc(len+3);
+            cf->cp_item[i].sval = s = ArenaAlloc(cf->arena, len+3);
             *s++ = (len >> 8);
             *s++ = len & 0xff;
             while(len-- > 0)
-                *s++ = fgetc(f);
+                *s++ = ReadU1(f);
             *s = 0;
             break;
         case CP_Integer:
@@ -116,18 +161,18 @@ static void ReadConstantPool(FILE *f, ClassFile *cf) {\
 }
 
 
-static void ReadInterfaces(FILE *f, ClassFile *cf) {
+static void ReadInterfaces(ClassBytes *f, ClassFile *cf) {
     int cnt;
     uint16_t *ip;
     cf->interfaces_count = cnt = ReadU2(f);
-    cf->interfaces = ip = SafeCalloc(cnt,2);
+    cf->interfaces = ip = ArenaAlloc(cf->arena, cnt*2);
     while(cnt-- > 0) 
         *ip++ = ReadU2(f);
 }
 
 
 // Reads up to 3 different attributes
-static void ReadAttributes(FILE *f, ClassFile *cf, ... ) {
+static void ReadAttributes(ClassBytes *f, ClassFile *cf, ... ) {
     int acnt;
     va_list argp;
     char *name[3];
@@ -161,26 +206,27 @@ static void ReadAttributes(FILE *f, ClassFile *cf, ... ) {
             if (strcmp(s,name[i]) == 0) {
                 /* this is an attribute we want */
                 *length[i] = len;
-                *where[i] = ap = SafeMalloc(len);
-                fread(ap, 1, len, f);
+                *where[i] = ap = ArenaAlloc(cf->arena, len);
+                memcpy(ap, f->next, (len < f->end - f->next)? len : f->end - f->next);
+                SkipBytes(f, len);
                 break;
             }
         }
         if (ap == NULL && len > 0)
             /* it's an attribute we ignore */
-            fseek(f,len,SEEK_CUR);
+            SkipBytes(f, len);
     }
 }
 
 
-static void ReadFields(FILE *f, ClassFile *cf) {
+static void ReadFields(ClassBytes *f, ClassFile *cf) {
     int cnt;
     field_info *ip;
     uint32_t attr_len;
     uint8_t *attr;
 
     cf->fields_count = cnt = ReadU2(f);
-    cf->fields = ip = SafeCalloc(cnt, sizeof(field_info));
+    cf->fields = ip = ArenaAlloc(cf->arena, cnt*sizeof(field_info));
     while(cnt-- > 0) {
         ip->access_flags = ReadU2(f);
         ip->name_index = ReadU2(f);
@@ -237,56 +283,28 @@ int CountParameters( uint8_t *s ) {
 }
 
 
-static void ReadMethods(FILE *f, ClassFile *cf) {
-    int cnt;
+static void ReadMethods(ClassBytes *f, ClassFile *cf) {
+    int cnt, acnt;
     method_info *ip;
-    uint32_t attr_len;
-    uint8_t *attr;
 
     cf->methods_count = cnt = ReadU2(f);
-    cf->methods = ip = SafeCalloc(cnt, sizeof(method_info));
+    cf->methods = ip = ArenaAlloc(cf->arena, cnt*sizeof(method_info));
     while(cnt-- > 0) {
-        uint8_t *ptr;
-        int ix, dix;
+        int dix;
         ConstantPoolItem *cpi;
     
         ip->access_flags = ReadU2(f);
         ip->name_index = ReadU2(f);
         ip->descriptor_index = ReadU2(f);
-        attr = NULL;
-        attr_len = 0;
-        ReadAttributes(f, cf, "Code", &attr_len, &attr, NULL);
-        if (attr != NULL && attr_len > 0) {
-            ix = 0;
-            ip->max_stack = (attr[ix]<<8)+attr[ix+1];
-            ix += 2;
-            ip->max_locals = (attr[ix]<<8)+attr[ix+1];
-            ix += 2;
-            ip->code_length = (attr[ix]<<24)+(attr[ix+1]<<16)+
-                 (attr[ix+2]<<8)+attr[ix+3];
-            ix += 4;
-            if (ip->code_length > 0) {
-                ip->code = ptr = SafeMalloc(ip->code_length);
-                memcpy(ptr, attr+ix, ip->code_length);
-            } else
-                ip->code = NULL;
-            ix += ip->code_length;
-            ip->exception_table_length = (attr[ix]<<8) + attr[ix+1];
-            ix += 2;
-            if (ip->exception_table_length > 0) {
-                ip->exception_table = ptr = SafeMalloc(ip->exception_table_length);
-                memcpy(ptr, attr+ix, ip->exception_table_length);
-            } else
-                ip->exception_table = NULL;
-            ix += ip->exception_table_length;
-            ip->attributes_count = (attr[ix]<<8) + attr[ix+1];
-            ix += 2;
-            if (ip->attributes_count > 0) {
-                ip->attributes = ptr = SafeMalloc(ip->attributes_count);
-                memcpy(ptr, attr+ix, ip->attributes_count);
-            } else
-                ip->attributes = NULL;
-            SafeFree(attr);
+        /* just note where the Code attribute is */
+        acnt = ReadU2(f);
+        while(acnt-- > 0) {
+            uint16_t ix = ReadU2(f);
+            uint32_t len = ReadU4(f);
+            if (len >= 12 && len <= f->end - f->next
+                    && strcmp(GetUTF8(cf,ix), "Code") == 0)
+                ip->body = f->next;
+            SkipBytes(f, len);
         }
         /* extra analysis needed for run-time */
         dix = ip->descriptor_index;
@@ -299,32 +317,165 @@ static void ReadMethods(FILE *f, ClassFile *cf) {
 }
 
 
+/* Completes the method_info struct for method m of class cf, from the
+   Code attribute that ReadMethods found, then verifies the method.
+   It must be called before the method is used, if m->body is not NULL. */
+void MaterializeMethod( ClassFile *cf, method_info *m ) {
+    uint8_t *attr = m->body;
+    int ix = 0;
+
+    m->body = NULL;
+    m->max_stack = (attr[ix]<<8)+attr[ix+1];
+    ix += 2;
+    m->max_locals = (attr[ix]<<8)+attr[ix+1];
+    ix += 2;
+    m->code_length = (attr[ix]<<24)+(attr[ix+1]<<16)+
+         (attr[ix+2]<<8)+attr[ix+3];
+    ix += 4;
+    m->code = (m->code_length > 0)? attr+ix : NULL;
+    ix += m->code_length;
+    m->exception_table_length = (attr[ix]<<8) + attr[ix+1];
+    ix += 2;
+    m->exception_table = (m->exception_table_length > 0)? attr+ix : NULL;
+    ix += m->exception_table_length;
+    m->attributes_count = (attr[ix]<<8) + attr[ix+1];
+    ix += 2;
+    m->attributes = (m->attributes_count > 0)? attr+ix : NULL;
+    if (!cf->verified)
+        VerifyMethod(cf, m);
+}
+
+
+/* Creates the ClassFile struct, with its arena, and brings the whole of
+   the class file f into memory.  A file is mapped; other streams (archive
+   members) are copied into the arena.  f is closed. */
+static ClassFile *LoadClassBytes( FILE *f ) {
+    ClassFile *cf;
+    Arena *arena;
+    struct stat sb;
+    long size;
+    void *p = MAP_FAILED;
+
+    if (fstat(fileno(f), &sb) == 0 && S_ISREG(sb.st_mode) && sb.st_size > 0) {
+        size = sb.st_size;
+        p = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fileno(f), 0);
+    } else if (fseek(f, 0, SEEK_END) != 0 || (size = ftell(f)) <= 0) {
+        fclose(f);
+        return NULL;
+    }
+    // the parsed class is rarely bigger than twice the class file
+    arena = NewArena(2*size + sizeof(ClassFile));
+    cf = ArenaAlloc(arena, sizeof(ClassFile));
+    cf->arena = arena;
+    if (p != MAP_FAILED) {
+        cf->image = p;
+        cf->image_size = size;
+        cf->image_mapped = 1;
+    } else {
+        rewind(f);
+        cf->image = ArenaAlloc(arena, size);
+        cf->image_size = fread(cf->image, 1, size, f);
+    }
+    fclose(f);
+    return cf;
+}
+
+
+/* Releases the storage of a class read by ParseClassFile */
+void FreeClassFile( ClassFile *cf ) {
+    if (cf->arena == NULL)
+        return;  // it belongs to the shared class archive
+    if (cf->image_mapped)
+        munmap(cf->image, cf->image_size);
+    FreeArena(cf->arena);
+}
+
+
+/* Builds the ClassFile struct from the contents of a class file, then
+   closes the stream.  The result is NULL if f is not a class file.
+   This function may be called by several threads at once. */
+ClassFile *ParseClassFile( FILE *fp ) {
+    ClassFile *result;
+    ClassBytes cb, *f = &cb;
+    uint16_t t1;
+    char *cname;
+    uint64_t startTime = 0, readTime = 0;
+
+    if (startupStats)
+        startTime = StartupClock();
+    result = LoadClassBytes(fp);
+    if (result == NULL)
+        return NULL;
+    if (startupStats)
+        readTime = StartupClock();
+    f->next = result->image;
+    f->end = result->image + result->image_size;
+    if (ReadU4(f) != MagicNumber) {
+        FreeClassFile(result);
+        return NULL;
+    }
+    t1 = ReadU2(f);  // minor version
+    t1 = ReadU2(f);  // major version
+    ReadConstantPool(f,result);
+    result->access_flags = ReadU2(f);
+    result->this_class = ReadU2(f);
+    result->super_class = ReadU2(f);
+    ReadInterfaces(f,result);
+    ReadFields(f,result);
+    ReadMethods(f,result);
+    ReadAttributes(f, result, NULL);
+    cname = GetCPItemAsString(result,result->this_class);
+    result->cname = strcpy(ArenaAlloc(result->arena, strlen(cname)+1), cname);
+    SafeFree(cname);
+    if (startupStats) {
+        RecordStartupTime(PHASE_READ, result->cname, readTime - startTime);
+        RecordStartupTime(PHASE_PARSE, result->cname, StartupClock() - readTime);
+    }
+    return result;
+}
+
+
 ClassFile *ReadClassFile( char *classname ) {
     FILE *f;
     ClassFile *result;
-    uint16_t t1;
     char *filename;
     FileNameList fnp;
+    NameEntry *fne;
+    uint64_t startTime = 0;
 
     filename = SafeMalloc(strlen(classname)+7);
     strcpy(filename,classname);
     strcat(filename,".class");
 
     // Check if we have already tried to read this file
-    for( fnp = filesRead;  fnp != NULL;  fnp = fnp->next ) {
-        if (strcmp(fnp->filename,filename) == 0) {
-            SafeFree(filename);
-            fnp->cnt++;
-            return NULL;  // we have tried to read it before
-        }
+    fne = NameTableLookup(&filesReadTable, filename);
+    if (fne != NULL) {
+        SafeFree(filename);
+        fnp = fne->value;
+        fnp->cnt++;
+        return NULL;  // we have tried to read it before
     }
     fnp = SafeMalloc(sizeof(*fnp));
     fnp->filename = filename;
     fnp->cnt = 1;
     fnp->next = filesRead;
     filesRead = fnp;
-
-    f = fopen(filename, "rb");
+    NameTableInsert(&filesReadTable, filename)->value = fnp;
+
+    if (startupStats)
+        startTime = StartupClock();
+    // The shared class archive may hold a parsed copy
+    result = FindArchivedClass(classname);
+
+    // A prefetch thread may have read the file already
+    if (result == NULL)
+        result = TakePrefetchedClass(classname);
+
+    f = (result == NULL)? OpenClassFile(classname, NULL) : NULL;
+    if (startupStats)
+        RecordStartupTime(PHASE_OPEN, classname, StartupClock() - startTime);
+    if (result != NULL)
+        return result;
     if (f == NULL) {
         // Our interpreter simply does not support loading of built-in
         // classes, so suppress the error message in this case
@@ -332,23 +483,11 @@ ClassFile *ReadClassFile( char *classname ) {
             fprintf(stderr, "Unable to read file %s\n", filename);
         return NULL;
     }
-    if (ReadU4(f) != MagicNumber) {
+    result = ParseClassFile(f);
+    if (result == NULL) {
         fprintf(stderr, "File %s does not begin with magic number\n", filename);
         exit(1);
     }
-    result = SafeMalloc(sizeof(ClassFile));
-    t1 = ReadU2(f);  // minor version
-    t1 = ReadU2(f);  // major version
-    ReadConstantPool(f,result);
-    result->access_flags = ReadU2(f);
-    result->this_class = ReadU2(f);
-    result->super_class = ReadU2(f);
-    ReadInterfaces(f,result);
-    ReadFields(f,result);
-    ReadMethods(f,result);
-    ReadAttributes(f, result, NULL);
-    result->cname = GetCPItemAsString(result,result->this_class);
-    fclose(f);
+    PrefetchReferencedClasses(result);
     return result;
 }
-
@@ -4,11 +4,15 @@
 
 #define READCLASSFILEH
 
+#include <stdio.h>   /* to define FILE */
 #include <stdint.h>  /* to define uint8_t */
 #include "ClassFileFormat.h"  /* to define ClassFile type */
 
 extern void PrintFilesRead();
 extern int CountParameters( uint8_t *s );
+extern ClassFile *ParseClassFile( FILE *f );
+extern void MaterializeMethod( ClassFile *cf, method_info *m );
+extern void FreeClassFile( ClassFile *cf );
 extern ClassFile *ReadClassFile( char *filename );
 
 #endif
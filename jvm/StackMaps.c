@@ -0,0 +1,434 @@
+/* StackMaps.c */
+
+/*
+   Stack maps tell the garbage collector which slots of a method's frame
+   on the JVM stack hold references.
+
+   * GetStackMap -- returns the map of a frame at one instruction
+
+   The maps of a method are computed the first time that the collector
+   finds a frame of the method on the stack.  The types of the values in
+   the local variables and on the operand stack are followed through the
+   bytecode, much as the verifier does, except that the only distinction
+   kept is whether or not a slot holds a reference.  A slot which holds
+   a reference on one path to an instruction and something else on
+   another cannot be used there, so it is taken not to hold a reference.
+
+   A map is kept only for the instructions at which a collection can
+   happen: those which may allocate storage, load a class or invoke a
+   method.  A method which uses jsr, ret or wide has no maps, and its
+   frames are scanned conservatively.  Exception handlers are not
+   followed, as an exception halts the program.
+
+   The maps are found through a hash table keyed by the address of the
+   method_info, as the methods of archived classes are read-only.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "ClassFileFormat.h"
+#include "OpcodeSignatures.h"
+#include "TraceOptions.h"
+#include "MyAlloc.h"
+#include "StackMaps.h"
+
+#define MAPTABLESIZE 256
+
+/* the types of the slots, as far as the collector is concerned */
+#define NOTREF 0
+#define ISREF  1
+
+typedef struct MethodMaps {
+    method_info *method;
+    struct MethodMaps *next;    /* next in the same hash bucket */
+    int numPoints;              /* number of instructions with maps */
+    int wordsPerMap;
+    uint16_t *offsets;          /* offset of each such instruction, ascending */
+    uint16_t *depths;           /* depth of the operand stack there */
+    uint32_t *bits;             /* wordsPerMap words for each instruction */
+} MethodMaps;
+
+static MethodMaps *mapTable[MAPTABLESIZE];
+
+/* The state of the analysis of one method */
+typedef struct {
+    ClassFile *cf;
+    method_info *m;
+    int numSlots;       /* max_locals + max_stack */
+    uint8_t *types;     /* numSlots slot types for each offset in the code */
+    int *depth;         /* stack depth at each offset, or -1 if not reached */
+    int *work;          /* offsets of the instructions still to be followed */
+    uint8_t *queued;    /* nonzero if the offset is in work */
+    int numWork;
+} Analysis;
+
+
+static int get2( uint8_t *p ) {
+    return (p[0] << 8) | p[1];
+}
+
+static int32_t get4( uint8_t *p ) {
+    return (int32_t)(((uint32_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3]);
+}
+
+
+/* Returns the number of bytes in the instruction at offset pc */
+static int instructionLength( uint8_t *code, int pc ) {
+    int op = code[pc], pad = (pc + 4) & ~3;
+
+    switch(op) {
+    case 0xaa:  /* tableswitch */
+        return pad + 12 + 4*(get4(code+pad+8) - get4(code+pad+4) + 1) - pc;
+    case 0xab:  /* lookupswitch */
+        return pad + 8 + 8*get4(code+pad+4) - pc;
+    case 0xc4:  /* wide */
+        return (code[pc+1] == 0x84)? 6 : 4;
+    }
+    if (op > LASTOPCODE)
+        return 1;
+    return 1 + strlen(opcodes[op].inlineOperands);
+}
+
+
+/* Returns 1 if a garbage collection can happen during the instruction */
+static int isSafePoint( int op ) {
+    return op == 0x12 || op == 0x13         /* ldc, ldc_w */
+        || (op >= 0xb2 && op <= 0xbd)       /* field access, invoke, new */
+        || op == 0xc0 || op == 0xc1         /* checkcast, instanceof */
+        || op == 0xc5;                      /* multianewarray */
+}
+
+
+/* Returns the number of slots taken by a value of the type whose
+   descriptor starts at *sp, and steps *sp past the descriptor; *isRef
+   is set if the value is a reference */
+static int parseType( char **sp, int *isRef ) {
+    char *s = *sp, c = *s;
+
+    while(*s == '[')
+        s++;
+    if (*s == 'L')
+        s = strchr(s, ';');
+    *sp = s + 1;
+    *isRef = (c == 'L' || c == '[');
+    return (c == 'D' || c == 'J')? 2 : 1;
+}
+
+
+/* Returns the type descriptor of the field or method which the Fieldref
+   or Methodref item ix in the constant pool refers to */
+static char *memberDescriptor( ClassFile *cf, int ix ) {
+    int ntix = cf->cp_item[ix].ss.sval2;
+    return (char *)cf->cp_item[cf->cp_item[ntix].ss.sval2].sval + 2;
+}
+
+
+static int push( method_info *m, uint8_t *stack, int *depthp, int type, int width ) {
+    if (*depthp + width > m->max_stack)
+        return 0;
+    while(width-- > 0)
+        stack[(*depthp)++] = type;
+    return 1;
+}
+
+
+/* Applies the instruction at offset pc to the slot types in cur, where
+   the operand stack has depth *depthp.  The result is 0 if the effect of
+   the instruction cannot be followed. */
+static int followInstruction( Analysis *a, int pc, uint8_t *cur, int *depthp ) {
+    method_info *m = a->m;
+    uint8_t *code = m->code, *stack = cur + m->max_locals;
+    uint8_t popped[8];
+    char letters[8], *sig, *desc;
+    int op = code[pc], n = 0, i, j, isRef, width, local = -1, type = NOTREF;
+
+    switch(op) {
+    case 0x12:  /* ldc */
+    case 0x13:  /* ldc_w */
+        i = (op == 0x12)? code[pc+1] : get2(code+pc+1);
+        isRef = a->cf->cp_tag[i] == CP_String || a->cf->cp_tag[i] == CP_Class;
+        return push(m, stack, depthp, isRef? ISREF : NOTREF, 1);
+    case 0x14:  /* ldc2_w */
+        return push(m, stack, depthp, NOTREF, 2);
+    case 0xb2:  /* getstatic */
+    case 0xb3:  /* putstatic */
+    case 0xb4:  /* getfield */
+    case 0xb5:  /* putfield */
+        desc = memberDescriptor(a->cf, get2(code+pc+1));
+        width = parseType(&desc, &isRef);
+        n = (op == 0xb3)? width : (op == 0xb4)? 1 : (op == 0xb5)? width+1 : 0;
+        if (n > *depthp)
+            return 0;
+        *depthp -= n;
+        if (op == 0xb3 || op == 0xb5)
+            return 1;
+        return push(m, stack, depthp, isRef? ISREF : NOTREF, width);
+    case 0xb6:  /* invokevirtual */
+    case 0xb7:  /* invokespecial */
+    case 0xb8:  /* invokestatic */
+    case 0xb9:  /* invokeinterface */
+        desc = memberDescriptor(a->cf, get2(code+pc+1));
+        n = (op == 0xb8)? 0 : 1;
+        for( desc++;  *desc != ')';  )
+            n += parseType(&desc, &isRef);
+        if (n > *depthp)
+            return 0;
+        *depthp -= n;
+        if (*++desc == 'V')
+            return 1;
+        width = parseType(&desc, &isRef);
+        return push(m, stack, depthp, isRef? ISREF : NOTREF, width);
+    case 0xc5:  /* multianewarray */
+        if (code[pc+3] > *depthp)
+            return 0;
+        *depthp -= code[pc+3];
+        return push(m, stack, depthp, ISREF, 1);
+    case 0xa8:  /* jsr */
+    case 0xa9:  /* ret */
+    case 0xba:  /* invokedynamic */
+    case 0xc4:  /* wide */
+    case 0xc9:  /* jsr_w */
+        return 0;
+    case 0x36:  /* istore */
+    case 0x38:  /* fstore */
+        local = code[pc+1];
+        width = 1;
+        break;
+    case 0x37:  /* lstore */
+    case 0x39:  /* dstore */
+        local = code[pc+1];
+        width = 2;
+        break;
+    case 0x3a:  /* astore */
+        local = code[pc+1];
+        width = 1;
+        break;
+    default:
+        if (op > LASTOPCODE)
+            return 0;
+        if (op >= 0x3b && op <= 0x4e) {  /* istore_0 ... astore_3 */
+            local = (op - 0x3b) % 4;
+            width = ((op - 0x3b) / 4 == 1 || (op - 0x3b) / 4 == 3)? 2 : 1;
+        }
+    }
+    if (local >= 0) {
+        if (local + width > m->max_locals || *depthp == 0)
+            return 0;
+        if (op == 0x3a || (op >= 0x4b && op <= 0x4e))
+            type = stack[*depthp - 1];
+    }
+
+    /* pop the values on the left of the signature, then push those on
+       the right; W, X, Y and Z stand for values which are copied */
+    sig = opcodes[op].signature;
+    for( ;  *sig != '\0' && *sig != '>';  sig++ ) {
+        if (*sig == '-')
+            continue;
+        if (*sig == '*' || n >= 8)
+            return 0;
+        letters[n++] = *sig;
+    }
+    if (n > *depthp)
+        return 0;
+    *depthp -= n;
+    memcpy(popped, stack + *depthp, n);
+    if (*sig == '>')
+        sig++;
+    for( ;  *sig != '\0';  sig++ ) {
+        if (*sig == 'W' || *sig == 'X' || *sig == 'Y' || *sig == 'Z') {
+            for( j = 0;  j < n && letters[j] != *sig;  j++ )
+                ;
+            if (j == n)
+                return 0;
+            isRef = popped[j];
+        } else if (*sig == '*')
+            return 0;
+        else
+            isRef = (*sig == 'A' || *sig == 'N');
+        if (!push(m, stack, depthp, isRef? ISREF : NOTREF, 1))
+            return 0;
+    }
+
+    if (local >= 0) {
+        for( i = 0;  i < width;  i++ )
+            cur[local+i] = type;
+    }
+    return 1;
+}
+
+
+/* Merges the slot types in cur into the state of the instruction at
+   offset target, and queues it if the state changed.  The result is 0
+   if the states cannot be merged. */
+static int mergeInto( Analysis *a, int target, uint8_t *cur, int depth ) {
+    uint8_t *types;
+    int i, changed = 0;
+
+    if (target < 0 || target >= a->m->code_length)
+        return 0;
+    types = a->types + target * a->numSlots;
+    if (a->depth[target] < 0) {
+        memcpy(types, cur, a->numSlots);
+        a->depth[target] = depth;
+        changed = 1;
+    } else if (a->depth[target] != depth) {
+        return 0;
+    } else {
+        for( i = 0;  i < a->m->max_locals + depth;  i++ ) {
+            if (types[i] != cur[i] && types[i] != NOTREF) {
+                types[i] = NOTREF;
+                changed = 1;
+            }
+        }
+    }
+    if (changed && !a->queued[target]) {
+        a->queued[target] = 1;
+        a->work[a->numWork++] = target;
+    }
+    return 1;
+}
+
+
+/* Follows the slot types through the method; the result is 0 if that
+   is not possible */
+static int analyzeMethod( Analysis *a ) {
+    method_info *m = a->m;
+    uint8_t *code = m->code;
+    uint8_t *cur = SafeCalloc(a->numSlots, 1);
+    char *desc = (char *)a->cf->cp_item[m->descriptor_index].sval + 2;
+    int pc, op, len, depth, pad, i, n, isRef, ok = 1;
+
+    /* the initial state holds the arguments in the local variables */
+    n = 0;
+    if ((m->access_flags & ACC_STATIC) == 0)
+        cur[n++] = ISREF;
+    for( desc++;  *desc != ')' && n < m->max_locals;  ) {
+        int width = parseType(&desc, &isRef);
+        cur[n] = isRef? ISREF : NOTREF;
+        n += width;
+    }
+    mergeInto(a, 0, cur, 0);
+
+    while(ok && a->numWork > 0) {
+        pc = a->work[--a->numWork];
+        a->queued[pc] = 0;
+        memcpy(cur, a->types + pc * a->numSlots, a->numSlots);
+        depth = a->depth[pc];
+        if (!followInstruction(a, pc, cur, &depth)) {
+            ok = 0;
+            break;
+        }
+        op = code[pc];
+        len = instructionLength(code, pc);
+        if (op == 0xaa || op == 0xab) {  /* tableswitch, lookupswitch */
+            pad = (pc + 4) & ~3;
+            ok = mergeInto(a, pc + get4(code+pad), cur, depth);
+            if (op == 0xaa) {
+                n = get4(code+pad+8) - get4(code+pad+4) + 1;
+                for( i = 0;  ok && i < n;  i++ )
+                    ok = mergeInto(a, pc + get4(code+pad+12+4*i), cur, depth);
+            } else {
+                n = get4(code+pad+4);
+                for( i = 0;  ok && i < n;  i++ )
+                    ok = mergeInto(a, pc + get4(code+pad+12+8*i), cur, depth);
+            }
+            continue;
+        }
+        if (opcodes[op].inlineOperands[0] == 'b') {  /* a branch */
+            int offset = (len == 3)? (int16_t)get2(code+pc+1) : get4(code+pc+1);
+            ok = mergeInto(a, pc + offset, cur, depth);
+        }
+        if (op == 0xa7 || op == 0xc8                /* goto, goto_w */
+                || (op >= 0xac && op <= 0xb1)       /* the returns */
+                || op == 0xbf)                      /* athrow */
+            continue;
+        if (ok)
+            ok = mergeInto(a, pc + len, cur, depth);
+    }
+    SafeFree(cur);
+    return ok;
+}
+
+
+/* Computes the maps for method m of class cf */
+static MethodMaps *buildMaps( ClassFile *cf, method_info *m ) {
+    MethodMaps *mm = SafeCalloc(1, sizeof(MethodMaps));
+    Analysis a;
+    int pc, n, i;
+    uint32_t *bits;
+
+    mm->method = m;
+    a.cf = cf;
+    a.m = m;
+    a.numSlots = m->max_locals + m->max_stack;
+    a.types = SafeCalloc(m->code_length, a.numSlots > 0? a.numSlots : 1);
+    a.depth = SafeCalloc(m->code_length, sizeof(int));
+    a.work = SafeCalloc(m->code_length, sizeof(int));
+    a.queued = SafeCalloc(m->code_length, 1);
+    a.numWork = 0;
+    for( pc = 0;  pc < m->code_length;  pc++ )
+        a.depth[pc] = -1;
+
+    if (analyzeMethod(&a)) {
+        for( pc = 0;  pc < m->code_length;  pc += instructionLength(m->code, pc) )
+            if (a.depth[pc] >= 0 && isSafePoint(m->code[pc]))
+                mm->numPoints++;
+        mm->wordsPerMap = a.numSlots/32 + 1;
+        mm->offsets = SafeCalloc(mm->numPoints + 1, sizeof(uint16_t));
+        mm->depths = SafeCalloc(mm->numPoints + 1, sizeof(uint16_t));
+        mm->bits = SafeCalloc(mm->numPoints*mm->wordsPerMap + 1, sizeof(uint32_t));
+        n = 0;
+        for( pc = 0;  pc < m->code_length;  pc += instructionLength(m->code, pc) ) {
+            if (a.depth[pc] < 0 || !isSafePoint(m->code[pc]))
+                continue;
+            mm->offsets[n] = pc;
+            mm->depths[n] = a.depth[pc];
+            bits = mm->bits + n*mm->wordsPerMap;
+            for( i = 0;  i < m->max_locals + a.depth[pc];  i++ )
+                if (a.types[pc*a.numSlots + i] == ISREF)
+                    bits[i/32] |= 1 << (i%32);
+            n++;
+        }
+    } else if (tracingExecution & TRACE_HEAP) {
+        char *name = GetCPItemAsString(cf, m->name_index);
+        printf("* no stack maps for method %s of class %s\n", name, cf->cname);
+        SafeFree(name);
+    }
+    SafeFree(a.types);
+    SafeFree(a.depth);
+    SafeFree(a.work);
+    SafeFree(a.queued);
+    return mm;
+}
+
+
+uint32_t *GetStackMap( ClassFile *cf, method_info *m, int pcOffset, int *numSlots ) {
+    int h = ((uintptr_t)m / sizeof(method_info)) % MAPTABLESIZE;
+    int lo, hi, mid;
+    MethodMaps *mm;
+
+    for( mm = mapTable[h];  mm != NULL && mm->method != m;  mm = mm->next )
+        ;
+    if (mm == NULL) {
+        mm = buildMaps(cf, m);
+        mm->next = mapTable[h];
+        mapTable[h] = mm;
+    }
+    /* find the last instruction with a map at or before pcOffset */
+    lo = 0;
+    hi = mm->numPoints - 1;
+    while(lo <= hi) {
+        mid = (lo + hi) / 2;
+        if (mm->offsets[mid] <= pcOffset)
+            lo = mid + 1;
+        else
+            hi = mid - 1;
+    }
+    if (hi < 0 || pcOffset >= mm->offsets[hi] + instructionLength(m->code, mm->offsets[hi]))
+        return NULL;
+    *numSlots = m->max_locals + mm->depths[hi];
+    return mm->bits + hi*mm->wordsPerMap;
+}
@@ -0,0 +1,18 @@
+/* StackMaps.h */
+
+#ifndef STACKMAPSH
+
+#define STACKMAPSH
+
+#include <stdint.h>
+#include "ClassFileFormat.h"  /* for ClassFile and method_info */
+
+/* The result has a bit for each local variable of method m, followed
+   by a bit for each value on the operand stack, which is set if that
+   slot holds a reference when the instruction at offset pcOffset is
+   executed; *numSlots is set to the number of bits.  The result is
+   NULL if the slots are unknown, and must be scanned conservatively. */
+extern uint32_t *GetStackMap( ClassFile *cf, method_info *m, int pcOffset,
+        int *numSlots );
+
+#endif
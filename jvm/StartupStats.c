@@ -0,0 +1,148 @@
+/* StartupStats.c */
+
+/*
+   Collects the times spent in each phase of starting up a program, as
+   requested by the -Xstartup-stats option.
+
+   * StartStartupStats   -- turns collection on
+   * StartupClock        -- reads the monotonic clock, in nanoseconds
+   * RecordStartupTime   -- adds time spent in a phase for a class
+   * StartupMainReached  -- notes that the main method is about to run
+   * PrintStartupStats   -- reports the totals for each phase, and the
+                            classes which took longest
+
+   The callers only read the clock when startupStats is nonzero, so the
+   cost is one test of a flag when the option is not used.
+
+   Times are wall-clock times and are inclusive: resolving a class
+   includes reading it and running its <clinit> method, which may in
+   turn resolve other classes.  Classes read by the prefetch threads
+   (see ClassPrefetch.c) have their read and parse times recorded too,
+   although that work overlaps with the main thread.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "NameTable.h"
+#include "MyAlloc.h"
+#include "StartupStats.h"
+
+typedef struct {
+    char *name;
+    uint64_t time[NUM_STARTUP_PHASES];
+    int count[NUM_STARTUP_PHASES];
+    uint64_t total;
+} ClassTimes;
+
+int startupStats = 0;
+
+static char *phaseName[NUM_STARTUP_PHASES] = {
+    "find/open", "read", "parse", "verify", "<clinit>", "resolve"
+};
+
+static uint64_t startTime;      /* when the JVM started */
+static uint64_t mainTime;       /* when main was reached, or 0 */
+static NameTable classTimes;
+static uint64_t phaseTime[NUM_STARTUP_PHASES];
+static int phaseCount[NUM_STARTUP_PHASES];
+// the prefetch threads record times too
+static pthread_mutex_t statsLock = PTHREAD_MUTEX_INITIALIZER;
+
+
+uint64_t StartupClock() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec*1000000000 + ts.tv_nsec;
+}
+
+
+/* Adds elapsed nanoseconds to the time spent in phase for class
+   classname */
+void RecordStartupTime( StartupPhase phase, char *classname,
+        uint64_t elapsed ) {
+    NameEntry *ne;
+    ClassTimes *t;
+
+    pthread_mutex_lock(&statsLock);
+    phaseTime[phase] += elapsed;
+    phaseCount[phase]++;
+    ne = NameTableInsert(&classTimes, classname);
+    t = ne->value;
+    if (t == NULL) {
+        t = ne->value = SafeMalloc(sizeof(ClassTimes));
+        t->name = ne->name;
+    }
+    t->time[phase] += elapsed;
+    t->count[phase]++;
+    t->total += elapsed;
+    pthread_mutex_unlock(&statsLock);
+}
+
+
+/* Starts collecting times; called as soon as the JVM starts */
+void StartStartupStats() {
+    startupStats = 1;
+    startTime = StartupClock();
+}
+
+
+/* Called just before the first instruction of main is executed */
+void StartupMainReached() {
+    mainTime = StartupClock();
+}
+
+
+static int byTotal( const void *a, const void *b ) {
+    uint64_t ta = (*(ClassTimes**)a)->total, tb = (*(ClassTimes**)b)->total;
+    return (ta < tb)? 1 : (ta > tb)? -1 : 0;
+}
+
+
+static void printTime( uint64_t ns, int count ) {
+    printf(" %9.3f ms %5d", ns/1e6, count);
+}
+
+
+/* Prints the time for each phase, then the topN classes which took
+   the longest in total */
+void PrintStartupStats( int topN ) {
+    ClassTimes **order;
+    NameEntry *ne;
+    int i, j, n = 0;
+
+    pthread_mutex_lock(&statsLock);
+    printf("\nStartup Statistics (times are inclusive)\n");
+    for( i = 0;  i < NUM_STARTUP_PHASES;  i++ ) {
+        printf("  %-10s", phaseName[i]);
+        printTime(phaseTime[i], phaseCount[i]);
+        printf("\n");
+    }
+    if (mainTime != 0)
+        printf("  time to main = %.3f ms\n", (mainTime - startTime)/1e6);
+
+    order = SafeCalloc(classTimes.numEntries+1, sizeof(ClassTimes*));
+    for( i = 0;  i < classTimes.numBuckets;  i++ )
+        for( ne = classTimes.buckets[i];  ne != NULL;  ne = ne->next )
+            order[n++] = ne->value;
+    qsort(order, n, sizeof(ClassTimes*), byTotal);
+    if (topN > n)
+        topN = n;
+    if (topN > 0)
+        printf("\n  Top %d classes (time and count per phase):\n", topN);
+    for( i = 0;  i < topN;  i++ ) {
+        printf("  %s\n", order[i]->name);
+        for( j = 0;  j < NUM_STARTUP_PHASES;  j++ ) {
+            if (order[i]->count[j] == 0)
+                continue;
+            printf("    %-10s", phaseName[j]);
+            printTime(order[i]->time[j], order[i]->count[j]);
+            printf("\n");
+        }
+    }
+    SafeFree(order);
+    pthread_mutex_unlock(&statsLock);
+}
@@ -0,0 +1,28 @@
+/* StartupStats.h */
+
+#ifndef STARTUPSTATSH
+
+#define STARTUPSTATSH
+
+#include <stdint.h>
+
+typedef enum {
+    PHASE_OPEN,         /* finding and opening a class file */
+    PHASE_READ,         /* bringing the class file into memory */
+    PHASE_PARSE,        /* building the ClassFile struct */
+    PHASE_VERIFY,       /* verifying a method */
+    PHASE_CLINIT,       /* running a <clinit> method */
+    PHASE_RESOLVE,      /* ResolveClassReferenceByName */
+    NUM_STARTUP_PHASES
+} StartupPhase;
+
+extern int startupStats;  /* nonzero if startup times are being collected */
+
+extern void StartStartupStats();
+extern uint64_t StartupClock();
+extern void RecordStartupTime( StartupPhase phase, char *classname,
+                uint64_t elapsed );
+extern void StartupMainReached();
+extern void PrintStartupStats( int topN );
+
+#endif
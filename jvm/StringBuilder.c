@@ -18,6 +18,7 @@
 #include "MyAlloc.h"
 #include "TraceOptions.h"
 #include "StringBuilder.h"
+#include "NativeClasses.h"
 
 char *StringBuilderName = "java/lang/StringBuilder";
 
@@ -56,8 +57,9 @@ void StringBuilderClass( char *methodName, char *methodDescr ) {
             hp = JVM_Pop();
             if (hp == NULL_HEAP_REFERENCE)
                 throwExceptionExternal("NullPointerException", methodName, StringBuilderName);
-            StringInstance *sp = REAL_HEAP_POINTER(hp);
-            sbAppend(sp->sval);
+            char *s = StringToUTF8(REAL_HEAP_POINTER(hp), NULL);
+            sbAppend(s);
+            SafeFree(s);
             return;
         }
         if (strcmp(methodDescr,"(I)Ljava/lang/StringBuilder;") == 0) {
@@ -94,11 +96,7 @@ void StringBuilderClass( char *methodName, char *methodDescr ) {
         if (hp == NULL_HEAP_REFERENCE)
             throwExceptionExternal("NullPointerException", methodName, StringBuilderName);
         sbi = REAL_HEAP_POINTER(hp);
-        StringInstance *sp = MyHeapAlloc(sizeof(StringInstance));
-        sp->kind = CODE_STRG;
-        sp->sval = SafeMalloc(sbi->len+1);
-        memcpy(sp->sval, sbi->buffer, sbi->len+1);
-        hp = MAKE_HEAP_REFERENCE(sp);
+        hp = MAKE_HEAP_REFERENCE(NewString(sbi->buffer, sbi->len));
         JVM_Push(hp);
         return;
     }
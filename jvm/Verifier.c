@@ -9,11 +9,15 @@
 #include <assert.h>
 
 #include "ClassFileFormat.h"
+#include "ReadClassFile.h"
 #include "OpcodeSignatures.h"
 #include "TraceOptions.h"
 #include "MyAlloc.h"
 #include "VerifierUtils.h"
 #include "Verifier.h"
+#include "StartupStats.h"
+
+int VerifyingMethods = 0;
 
 
 // Output an array of the verifier's type descriptors
@@ -1919,14 +1923,31 @@ static void verifyMethod( ClassFile *cf, method_info *m ) {
 // Verify the bytecode of all methods in class file cf
 void Verify( ClassFile *cf ) {
     int i;
-    if (VerifyingMethods) {
-      for( i = 0;  i < cf->methods_count;  i++ ) {
-        method_info *m = &(cf->methods[i]);
-	verifyMethod(cf, m);
-      }
-      if (tracingExecution & TRACE_VERIFY)
-    	fprintf(stdout, "Verification of class %s completed\n\n", cf->cname);
+    for( i = 0;  i < cf->methods_count;  i++ ) {
+      method_info *m = &(cf->methods[i]);
+      if (m->body != NULL)
+	MaterializeMethod(cf, m);  // which verifies it
+      else
+	VerifyMethod(cf, m);
+    }
+    if (VerifyingMethods && (tracingExecution & TRACE_VERIFY))
+      fprintf(stdout, "Verification of class %s completed\n\n", cf->cname);
+}
+
+
+// Verify the bytecode of one method, when it is first used
+void VerifyMethod( ClassFile *cf, method_info *m ) {
+    uint64_t startTime;
+
+    if (!VerifyingMethods)
+        return;
+    if (!startupStats) {
+        verifyMethod(cf, m);
+        return;
     }
+    startTime = StartupClock();
+    verifyMethod(cf, m);
+    RecordStartupTime(PHASE_VERIFY, cf->cname, StartupClock() - startTime);
 }
 
 
@@ -12,9 +12,10 @@ typedef struct {
 } InstructionInfo;
 
 extern void Verify( ClassFile *cf );
+extern void VerifyMethod( ClassFile *cf, method_info *m );
 extern void InitVerifier(void);
 
 // global flag to switch verification on and off
-static int VerifyingMethods = 0;
+extern int VerifyingMethods;
 
 #endif
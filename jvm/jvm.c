@@ -16,6 +16,7 @@ DataItem *JVM_Top;            /* ptr to current top element on stack */
 DataItem *JVM_StackLimit;     /* ptr to end of storage for stack */
 int JVM_StackSize;            /* size of stack area, as # of elements */
 void *Fake_System_Out;        /* pretends to be the java/lang/System.out value */
+JVM_Frame *JVM_CurrentFrame;  /* frame of the method being interpreted */
 
 
 void JVM_Init( int stackSize ) {
@@ -25,10 +26,12 @@ void JVM_Init( int stackSize ) {
     JVM_StackLimit = JVM_Stack + JVM_StackSize - 1;
     JVM_Top = JVM_Stack;
     JVM_Top->uval = UNINIT_PATTERN;  /* fake item on bottom of stack */
+    if (Fake_System_Out != NULL)
+        return;  /* it came from a heap snapshot */
     x = MyHeapAlloc(sizeof(ClassInstance));
     Fake_System_Out = x;
     x->kind = CODE_INST;
-    x->thisClass = NULL;
+    x->classRef = NULL_HEAP_REFERENCE;
     x->instField[0].uval = 0;
 }
 
@@ -59,7 +62,7 @@ void JVM_PushReference( HeapPointer x ) {
         fprintf(stderr, "stack overflow, execution must end\n");
         exit(1);
     }
-    assert(x >= 0 && x < MaxHeapPtr);
+    assert(x >= 0 && x < MAKE_HEAP_REFERENCE(LosEnd));
     if (tracingExecution & TRACE_STACK)  // PRIX32 is defined in inttypes.h
         printf("push heap reference 0x%" PRIX32 " onto stack; new height = %d\n",
             x, (int)(JVM_Top-JVM_Stack+1));
@@ -97,7 +100,7 @@ HeapPointer JVM_PopReference() {
         printf("pop heap reference 0x%" PRIX32 " from stack; new height = %d\n",
             JVM_Top->pval, (int)(JVM_Top-JVM_Stack-1));
     HeapPointer result = (JVM_Top--)->pval;
-    assert( result >= 0 && result < MaxHeapPtr);
+    assert( result >= 0 && result < MAKE_HEAP_REFERENCE(LosEnd));
     return result;
 }
 
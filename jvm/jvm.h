@@ -20,12 +20,40 @@ extern uint8_t *HeapStart;
 /* used as a NULL reference for a heap pointer */
 #define NULL_HEAP_REFERENCE  ((HeapPointer)0)
 
+#ifdef SCALED_REFERENCES
+
+/* Built with -DSCALED_REFERENCES, a reference counts 8 byte units from
+   HeapStart, so that it can reach 32GB rather than 4GB, for the heap as
+   well as the large object space.  Every object starts 4 bytes past an
+   8 byte boundary, after its size field, and the reference to it is the
+   number of the boundary which follows it. */
+#define HEAPREFSHIFT 3
+#define REAL_HEAP_POINTER(x) \
+    ((void*)(HeapStart + ((uint64_t)(x) << HEAPREFSHIFT) - 4))
+#define MAKE_HEAP_REFERENCE(p) \
+    ((HeapPointer)(((uint8_t*)(p) - HeapStart + 4) >> HEAPREFSHIFT))
+
+#else
+
+#define HEAPREFSHIFT 0
+
 /* converts a HeapReference x into a real pointer */
 #define REAL_HEAP_POINTER(x)    ((void*)(HeapStart + (x)))
 
 /* converts a real pointer into a HeapReference, an offset in the heap */
 #define MAKE_HEAP_REFERENCE(p)  ((HeapPointer)((uint8_t*)(p) - HeapStart))
 
+#endif
+
+/* the number of bytes from HeapStart which references can reach */
+#define MAXREFERENCEDBYTES  ((uint64_t)UINT32_MAX << HEAPREFSHIFT)
+
+/* the most that -Xmx may ask for: the references must still reach the
+   metaspace after the heap, and a large object space of MINLOSSIZE
+   bytes after that, so this is just under 4GB, or 32GB when scaled */
+#define MAXHEAPSIZE \
+    ((long)(MAXREFERENCEDBYTES - METASPACESIZE - MINLOSSIZE) & ~4095L)
+
 
 /* This structure is used to access either a local variable of
    a method or an item on the stack or a field of a class.
@@ -55,12 +83,15 @@ typedef struct {
 /* These fields precede the elements of an array on a heap. */
 /* This version is used for an array of simple values.      */
 /* See newarray opcode for list of typecode values.         */
+/* The elements follow the 12 bytes of fields without any   */
+/* padding, which puts them on an 8 byte boundary, as an    */
+/* object in the heap is 4 bytes past one.                  */
 typedef struct {
     uint32_t kind;             /* holds the chars 'ARRS' */
     int32_t size;              /* number of elements */
     int16_t typecode;          /* type of the elements */
     int16_t elemSize;          /* # bytes for each element */
-    union {
+    union __attribute__((packed, aligned(4))) {
         uint8_t   bval[8];  /* typecode == 4  */
         char      cval[8];  /* typecode == 5  */
         int16_t   hval[4];  /* typecode == 9  */
@@ -72,12 +103,28 @@ typedef struct {
 } ArrayOfSimple;
 
 
-/* a cheat implementation of strings on the heap */
+/* A string on the heap holds its characters itself, after its length.
+   A string whose characters are all below 256 has a byte for each
+   (Latin-1); any other has two (UTF-16).  As for an array of simple
+   values, the characters follow the 12 bytes of fields, on an 8 byte
+   boundary. */
 typedef struct {
     uint32_t kind;          /* holds the chars 'STRG' */
-    char *sval;
+    int32_t  length;        /* number of characters */
+    uint32_t coder;         /* STRING_LATIN1 or STRING_UTF16 */
+    union {
+        uint8_t  latin1[4];
+        uint16_t utf16[2];
+    } chars;                /* storage is allocated for length characters */
 } StringInstance;
 
+#define STRING_LATIN1 0
+#define STRING_UTF16  1
+
+/* the character at index ix of the StringInstance sp */
+#define STRING_CHAR(sp,ix) \
+    ((sp)->coder == STRING_LATIN1 ? (sp)->chars.latin1[ix] : (sp)->chars.utf16[ix])
+
 /* a cheat implementation of StringBuilder instances on the heap */
 typedef struct {
     uint32_t kind;          /* holds the chars 'SBLD' */
@@ -107,19 +154,39 @@ typedef struct ClassType {
     ClassFile *cf;                    /* the source file info */
     struct ClassType *parent;         /* super class */
     int numInstanceFields;            /* count of instance fields */
+    int numClassFields;               /* count of static fields */
+    uint32_t *instanceRefMap;         /* instance fields holding references */
+    uint32_t *classRefMap;            /* static fields holding references */
+    HeapPointer *stringConstants;     /* the interned String for each
+                                         CP_String item, once ldc has used it */
     DataItem classField[1];           /* storage for static fields */
 } ClassType;
 
+/* A reference map has a bit for each DataItem of a class's fields, set
+   if it holds a reference, so that the garbage collector can find them. */
+#define IS_REFERENCE_SLOT(map,i)  (((map)[(i)/32] >> ((i)%32)) & 1)
+
 
 /* One instance of this struct is allocated on the heap for each
    instance of a normal Java class.
-   The instField array contains storage for the instance fields. */
+   The instField array contains storage for the instance fields.
+   The class is referred to by its offset in the heap, as the elements
+   of an array are, so the fields follow 8 bytes of header. */
 typedef struct {
     uint32_t kind;              /* holds the chars 'INST' */
-    ClassType *thisClass;
+    HeapPointer classRef;       /* the ClassType of the object */
     DataItem instField[1];
 } ClassInstance;
 
+/* the ClassType of the ClassInstance ci, or NULL if it has none */
+#define INSTANCE_CLASS(ci) \
+    ((ci)->classRef == NULL_HEAP_REFERENCE ? NULL : \
+        (ClassType*)REAL_HEAP_POINTER((ci)->classRef))
+
+/* the number of bytes to allocate for an instance with n fields */
+#define INSTANCE_SIZE(n) \
+    (sizeof(ClassInstance) + ((n) > 1 ? (n) - 1 : 0)*sizeof(DataItem))
+
 
 #define CODE_ARRA (0x41525241)   /* the 4 characters 'ARRA' */
 #define CODE_ARRS (0x41525253)   /* the 4 characters 'ARRS' */
@@ -178,10 +245,24 @@ typedef enum { OP_aaload=0X32, OP_aastore=0X53, OP_aconst_null=0X01, OP_aload=0X
 } JVM_Opcode;
 
 
+/* Each method being interpreted has a frame, linked to the frame of its
+   caller, so that the garbage collector can find the method and current
+   instruction for each part of the JVM stack.  The frame's part of the
+   stack starts with its local variables. */
+typedef struct JVM_Frame {
+    struct JVM_Frame *caller;
+    ClassType *thisClass;
+    method_info *method;
+    DataItem *localVariable;
+    uint8_t **pcp;              /* the interpreter's program counter */
+} JVM_Frame;
+
+
 extern DataItem *JVM_Top;           // Was here before
 extern DataItem *JVM_Stack;         // Added by me
 extern void *HeapReferencePointer;
 extern void *Fake_System_Out;
+extern JVM_Frame *JVM_CurrentFrame;
 
 extern void JVM_Init( int stackSize );
 extern void JVM_Push( uint32_t x );
@@ -4,9 +4,15 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
 
 #include "ClassFileFormat.h"
 #include "ReadClassFile.h"
+#include "ClassPath.h"
+#include "ClassPrefetch.h"
+#include "ClassArchive.h"
+#include "HeapSnapshot.h"
 #include "PrintClassFile.h"
 #include "jvm.h"
 #include "InterpretLoop.h"
@@ -14,9 +20,13 @@
 #include "Verifier.h"
 #include "TraceOptions.h"
 #include "MyAlloc.h"
+#include "StartupStats.h"
+#include "NativeClasses.h"
 
 static char *pgmName = NULL;
 
+typedef enum { SHARE_OFF, SHARE_AUTO, SHARE_ON, SHARE_DUMP } ShareMode;
+
 static char *usageText[] = {
     "Usage:",
     "\t%s [options] classname [arguments for main method]",
@@ -33,7 +43,37 @@ static char *usageText[] = {
     "\t-Th\ttrace heap usage and gc",
     "\t-Tv\ttrace bytecode verificaton",
     "\t-Snnn\tset max stack size to nnn entries",
-    "\t-Hnnn\tset heap size to nnn bytes",
+    "\t-Hnnn\tset the initial heap size to nnn bytes",
+    "\t-Xmxnnn[k|m|g]\tlet the heap grow to nnn bytes, kilobytes,",
+    "\t\tmegabytes or gigabytes (the default is 64m; less than 4g,",
+    "\t\tor 32g when built with SCALED_REFERENCES)",
+    "\t\t(objects over 16K go in a separate space of the same size)",
+    "\t-Pnnn\tread class files ahead of use with nnn threads",
+    "\t\t(the default is one less than the number of processors)",
+    "\t-Xshare:dump\twrite the classes loaded by this run to the",
+    "\t\tshared class archive",
+    "\t-Xshare:auto\tuse the shared class archive if possible (default)",
+    "\t-Xshare:on\trequire the shared class archive to be used",
+    "\t-Xshare:off\tdo not use the shared class archive",
+    "\t-XX:SharedArchiveFile=file\tname the shared class archive",
+    "\t\t(the default is MyJVM.jsa)",
+    "\t-XX:ParallelGCThreads=n\tmark and sweep the heap with n threads",
+    "\t\t(the default is the number of processors)",
+    "\t-Xcheckpoint:file\tsave the heap in file once the main class",
+    "\t\thas been initialized",
+    "\t-Xrestore:file\tstart from the heap saved in file",
+    "\t-Xsweep:lazy\tsweep the heap after a gc as allocation needs",
+    "\t\tspace (default)",
+    "\t-Xsweep:background\talso sweep the heap with a separate thread",
+    "\t-Xsweep:eager\tsweep the whole heap during each gc",
+    "\t-Xmark:concurrent\tmark the heap with a separate thread while",
+    "\t\tthe program runs",
+    "\t-Xmark:stw\tmark the heap only in gc pauses (default)",
+    "\t-Xstartup-stats[:n]\treport the time spent reading, verifying,",
+    "\t\tinitializing and resolving classes, and the n classes which",
+    "\t\ttook longest (the default is 10)",
+    "\t-cp path\tsearch the directories and jar files in path",
+    "\t\t(a list separated by ':') for class files",
     NULL
 };
 
@@ -46,6 +86,35 @@ static void usage() {
     exit(1);
 }
 
+/* Returns the number of bytes given by the option value s: a number,
+   optionally followed by k, m or g for kilobytes, megabytes or
+   gigabytes.  If s is not of that form, or the size exceeds max, the
+   usage message is printed. */
+static long parseSize( char *option, char *s, long max ) {
+    char *end;
+    long n;
+    int shift = 0;
+
+    errno = 0;
+    n = strtol(s, &end, 10);
+    if (end == s || errno != 0 || n < 0)
+        n = -1;
+    else if (*end == 'k' || *end == 'K')
+        shift = 10;
+    else if (*end == 'm' || *end == 'M')
+        shift = 20;
+    else if (*end == 'g' || *end == 'G')
+        shift = 30;
+    if (shift != 0)
+        end++;
+    if (n < 0 || *end != '\0' || n > (max >> shift)) {
+        fprintf(stderr, "Invalid size in option %s (at most %ld bytes)\n",
+            option, max);
+        usage();
+    }
+    return n << shift;
+}
+
 static void callMain( ClassType *ct, int stackSize, int heapSize,
         char *jArgs[], int jArgCnt ) {
     static char *mainSignature = "([Ljava/lang/String;)V";
@@ -78,13 +147,13 @@ static void callMain( ClassType *ct, int stackSize, int heapSize,
     arr->classRef =  cta==NULL? NULL_HEAP_REFERENCE : MAKE_HEAP_REFERENCE(cta);
     JVM_PushReference(MAKE_HEAP_REFERENCE(arr));
     for( i = 0;  i < jArgCnt;  i++ ) {
-        StringInstance *p;
-        p = MyHeapAlloc(sizeof(StringInstance));
-        p->kind = CODE_STRG;
-        p->sval = jArgs[i];
+        StringInstance *p = NewString(jArgs[i], strlen(jArgs[i]));
         arr->elements[i] = MAKE_HEAP_REFERENCE(p);
+        WRITE_BARRIER(arr);
     }
 
+    if (startupStats)
+        StartupMainReached();
     InvokeMethod(ct,m,1);
 
     if (tracingExecution & TRACE_HEAP)
@@ -99,13 +168,65 @@ int main( int argc, char *argv[] ) {
     char *classname = NULL;
     int stackSize = 1024;
     int heapSize = 10240;
+    int prefetchThreads = sysconf(_SC_NPROCESSORS_ONLN) - 1;
     ClassType *ct;
     uint8_t DFlag = 0, XFlag = 0;
+    ShareMode shareMode = SHARE_AUTO;
+    char *archiveFile = "MyJVM.jsa";
+    char *checkpointFile = NULL, *restoreFile = NULL;
+    int startupTopN = 10;
 
     pgmName = argv[0];
+    ParallelGCThreads = sysconf(_SC_NPROCESSORS_ONLN);
     for( argNum=1; argNum<argc; argNum++ ) {
         char *cp = argv[argNum];
-        if (*cp == '-') {
+        if (strcmp(cp, "-cp") == 0 || strcmp(cp, "-classpath") == 0) {
+            if (++argNum >= argc) usage();
+            SetClassPath(argv[argNum]);
+        } else if (strncmp(cp, "-Xshare:", 8) == 0) {
+            if (strcmp(cp+8, "dump") == 0)
+                shareMode = SHARE_DUMP;
+            else if (strcmp(cp+8, "auto") == 0)
+                shareMode = SHARE_AUTO;
+            else if (strcmp(cp+8, "on") == 0)
+                shareMode = SHARE_ON;
+            else if (strcmp(cp+8, "off") == 0)
+                shareMode = SHARE_OFF;
+            else
+                usage();
+        } else if (strncmp(cp, "-XX:SharedArchiveFile=", 22) == 0) {
+            archiveFile = cp+22;
+        } else if (strncmp(cp, "-XX:ParallelGCThreads=", 22) == 0) {
+            ParallelGCThreads = atoi(cp+22);
+        } else if (strncmp(cp, "-Xcheckpoint:", 13) == 0) {
+            checkpointFile = cp+13;
+        } else if (strncmp(cp, "-Xrestore:", 10) == 0) {
+            restoreFile = cp+10;
+        } else if (strncmp(cp, "-Xsweep:", 8) == 0) {
+            if (strcmp(cp+8, "lazy") == 0)
+                SweepMode = SWEEP_LAZY;
+            else if (strcmp(cp+8, "background") == 0)
+                SweepMode = SWEEP_BACKGROUND;
+            else if (strcmp(cp+8, "eager") == 0)
+                SweepMode = SWEEP_EAGER;
+            else
+                usage();
+        } else if (strncmp(cp, "-Xmark:", 7) == 0) {
+            if (strcmp(cp+7, "concurrent") == 0)
+                ConcurrentMark = 1;
+            else if (strcmp(cp+7, "stw") == 0)
+                ConcurrentMark = 0;
+            else
+                usage();
+        } else if (strncmp(cp, "-Xmx", 4) == 0) {
+            MaxHeapSize = parseSize(cp, cp+4, MAXHEAPSIZE);
+        } else if (strncmp(cp, "-Xstartup-stats", 15) == 0) {
+            if (cp[15] == ':')
+                startupTopN = atoi(cp+16);
+            else if (cp[15] != '\0')
+                usage();
+            StartStartupStats();
+        } else if (*cp == '-') {
             switch(*++cp) {
             case 'D':   DFlag = 1;  break;
             case 'W':   showWarnings = 0;  break;
@@ -132,6 +253,7 @@ int main( int argc, char *argv[] ) {
                         break;
             case 'S':   stackSize = atoi(cp+1);  break;
             case 'H':   heapSize = atoi(cp+1);  break;
+            case 'P':   prefetchThreads = atoi(cp+1);  break;
             default:    usage();
             }
         } else {
@@ -144,12 +266,28 @@ int main( int argc, char *argv[] ) {
 
     if (classname == NULL) usage();
 
-    InitMyAlloc(heapSize);
-    JVM_Init(stackSize);
     InitVerifier();
+    if (shareMode == SHARE_AUTO || shareMode == SHARE_ON) {
+        if (!OpenClassArchive(archiveFile, shareMode == SHARE_ON)
+                && shareMode == SHARE_ON)
+            return 1;
+    }
+    ct = NULL;
+    if (restoreFile != NULL) {
+        printf("Restoring class %s from %s ...\n", classname, restoreFile);
+        ct = RestoreHeapSnapshot(restoreFile, classname);
+    }
+    if (ct == NULL)
+        InitMyAlloc(heapSize);
+    JVM_Init(stackSize);
+    StartClassPrefetch(prefetchThreads);
 
-    printf("Reading class %s ...\n", classname);
-    ct = LoadClass(classname);
+    if (ct == NULL) {
+        printf("Reading class %s ...\n", classname);
+        ct = LoadClass(classname);
+        if (ct != NULL && checkpointFile != NULL)
+            WriteHeapSnapshot(checkpointFile, ct);
+    }
     if (ct != NULL) {
         if (DFlag)
             PrintClassFile(ct->cf);
@@ -157,6 +295,10 @@ int main( int argc, char *argv[] ) {
             int numArgs = argc - argNum - 1;
             callMain(ct, stackSize, heapSize, argv+argNum+1, numArgs);
         }
+        if (shareMode == SHARE_DUMP)
+            DumpClassArchive(archiveFile);
+        if (startupStats)
+            PrintStartupStats(startupTopN);
     } else {
         fprintf(stderr, "Unable to read/parse classfile %s.class\n",
             classname);
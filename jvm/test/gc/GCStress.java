@@ -0,0 +1,46 @@
+
+/* Keeps a ring of 200 lists of 100 nodes and replaces them one at a
+   time, 6000 times.  Each list lives long enough to be promoted and
+   then dies in the old space, so at the default heap size the program
+   causes minor collections and full ones.  Both totals print 117990000. */
+class GCStress {
+
+	public GCStress next;
+	public int val;
+
+	public static GCStress build(int n, int v) {
+		GCStress head = null;
+		for (int i = 0; i < n; i++) {
+			GCStress temp = new GCStress();
+			temp.next = head;
+			temp.val = v;
+			head = temp;
+		}
+		return head;
+	}
+
+	public static int sum(GCStress p) {
+		int s = 0;
+		while (p != null) {
+			s += p.val;
+			p = p.next;
+		}
+		return s;
+	}
+
+	public static int total(GCStress[] ring) {
+		int s = 0;
+		for (int i = 0; i < ring.length; i++)
+			s += sum(ring[i]);
+		return s;
+	}
+
+	public static void main(String[] args) {
+		GCStress[] ring = new GCStress[200];
+		for (int i = 0; i < 6000; i++)
+			ring[i % 200] = build(100, i);
+		System.out.println(total(ring));
+		System.gc();
+		System.out.println(total(ring));
+	}
+}
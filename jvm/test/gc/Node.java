@@ -0,0 +1,44 @@
+
+/* Builds a long-lived list of 3000 nodes, then makes garbage: short
+   lists, strings and arrays.  The list should survive the collections
+   that the garbage causes, so both sums print 4498500. */
+class Node {
+
+	public Node next;
+	public int val;
+	public String name;
+
+	public static Node build(int n) {
+		Node head = null;
+		for (int i = 0; i < n; i++) {
+			Node temp = new Node();
+			temp.next = head;
+			temp.val = i;
+			head = temp;
+		}
+		return head;
+	}
+
+	public static int sum(Node p) {
+		int s = 0;
+		while (p != null) {
+			s += p.val;
+			p = p.next;
+		}
+		return s;
+	}
+
+	public static void main(String[] args) {
+		Node list = build(3000);
+		String last = null;
+		for (int i = 0; i < 200; i++) {
+			build(20);
+			last = new StringBuilder().append("x").append(i).toString();
+			int[] junk = new int[50];
+		}
+		System.out.println(sum(list));
+		System.out.println(last);
+		System.gc();
+		System.out.println(sum(list));
+	}
+}
@@ -0,0 +1,37 @@
+
+/* Checks that string literals are interned: the same literal gives the
+   same String each time, even while the collector removes the 50000
+   other strings interned in the loop.  A String built at run time is a
+   different object until it is interned.  The output should be
+
+	50000
+	0
+	1
+	1
+	1
+*/
+class Intern {
+
+	public static String lit() {
+		return "lit";
+	}
+
+	public static void main(String[] args) {
+		String a = "lit";
+		int same = 0;
+		for (int i = 0; i < 50000; i++) {
+			String b = "lit";
+			if (b == a)
+				same++;
+			new StringBuilder().append("junk").append(i).toString().intern();
+		}
+		System.out.println(same);
+
+		String c = new StringBuilder().append("li").append("t").toString();
+		System.out.println(c == "lit" ? 1 : 0);
+		System.out.println(c.intern() == "lit" ? 1 : 0);
+		System.gc();
+		System.out.println(c.intern() == a ? 1 : 0);
+		System.out.println(lit() == a ? 1 : 0);
+	}
+}
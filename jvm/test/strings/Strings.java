@@ -0,0 +1,62 @@
+
+/* Checks the two string representations: Latin-1 for "héllo wörld",
+   and UTF-16 for the others, the last with a surrogate pair.  Each string
+   is printed with its length and some of its characters, and then all of
+   them are joined by a StringBuilder and compared with the originals,
+   character by character.  The output should be
+
+	héllo wörld
+	11
+	233
+	246
+	Hello, 世界 €
+	11
+	19990
+	8364
+	smile 😀
+	8
+	55357
+	56832
+	héllo wörld | Hello, 世界 € | smile 😀42
+	38
+	0
+	0
+	0
+*/
+class Strings {
+
+	public static int differences(String a, String b, int from) {
+		int n = 0;
+		for (int i = 0; i < b.length(); i++)
+			if (a.charAt(from + i) != b.charAt(i))
+				n++;
+		return n;
+	}
+
+	public static void main(String[] args) {
+		String s = "héllo wörld";
+		String u = "Hello, 世界 €";
+		String e = "smile 😀";
+
+		System.out.println(s);
+		System.out.println(s.length());
+		System.out.println((int)s.charAt(1));
+		System.out.println((int)s.charAt(7));
+		System.out.println(u);
+		System.out.println(u.length());
+		System.out.println((int)u.charAt(7));
+		System.out.println((int)u.charAt(10));
+		System.out.println(e);
+		System.out.println(e.length());
+		System.out.println((int)e.charAt(6));
+		System.out.println((int)e.charAt(7));
+
+		String r = new StringBuilder().append(s).append(" | ").append(u)
+			.append(" | ").append(e).append(42).toString();
+		System.out.println(r);
+		System.out.println(r.length());
+		System.out.println(differences(r, s, 0));
+		System.out.println(differences(r, u, 14));
+		System.out.println(differences(r, e, 28));
+	}
+}